@@ -520,6 +520,7 @@ struct PreviewView: View {
     @State private var inputText = ""
     @State private var isGenerating = false
     @State private var isProcessingImage = false
+    @State private var imageInConversation = false  // follow-ups reuse the image already in context
     @Environment(\.dismiss) private var dismiss
     @StateObject private var modelManager = ModelManager.shared
     @State private var responseText = ""
@@ -537,6 +538,10 @@ struct PreviewView: View {
                         .padding()
                         .id(updateCount)  // Force view update on each token
                         .id("bottom")  // ID for scrolling
+                        .onTapGesture {
+                            // Show the rest of the reply without pacing
+                            modelManager.finishResponse()
+                        }
                 }
                 .frame(maxHeight: 200)
                 .background(Color(.systemBackground))
@@ -561,7 +566,10 @@ struct PreviewView: View {
                         .font(.system(size: 24))
                 }
                 
-                Button(action: { dismiss() }) {
+                Button(action: {
+                    modelManager.finishResponse()
+                    dismiss()
+                }) {
                     Image(systemName: "xmark.circle.fill")
                         .font(.system(size: 24))
                 }
@@ -591,6 +599,12 @@ struct PreviewView: View {
                 generateResponse(prompt: prompt)
             })
         }
+        .onAppear {
+            // Each captured photo starts its own conversation
+            modelManager.resetConversation()
+            imageInConversation = false
+            modelManager.prepareImage(image)
+        }
     }
     
     private func generateDescription() {
@@ -617,9 +631,12 @@ struct PreviewView: View {
         
         Task {
             do {
-                print("Processing image with prompt")
-                try await modelManager.processImage(image, prompt: prompt)
-                print("Image processed, starting text generation")
+                if !imageInConversation {
+                    print("Processing image with prompt")
+                    try await modelManager.processImage(image, prompt: prompt)
+                    imageInConversation = true
+                    print("Image processed, starting text generation")
+                }
                 
                 isProcessingImage = false
                 isGenerating = true
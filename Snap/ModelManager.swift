@@ -50,6 +50,8 @@ class ModelManager: NSObject, ObservableObject, URLSessionDownloadDelegate {
     
     private let defaultModelName = "SmolVLM2-256M-Video-Instruct"
     private var manager: UnsafeMutableRawPointer?
+    // The core streams one image at a time
+    private let ingestQueue = DispatchQueue(label: "ImageIngest", qos: .userInitiated)
     
     // List of available models
     let availableModels: [MTMDModelPair] = [
@@ -94,6 +96,17 @@ class ModelManager: NSObject, ObservableObject, URLSessionDownloadDelegate {
         isModelLoaded = isModelPairDownloaded(modelName: defaultModelName)
         
         manager = create_model_manager()
+        
+        // Idle conversations past the RAM budget are spilled here
+        let sessionsDirectory = FileManager.default.urls(for: .cachesDirectory, in: .userDomainMask)[0].appendingPathComponent("sessions")
+        try? FileManager.default.createDirectory(at: sessionsDirectory, withIntermediateDirectories: true, attributes: nil)
+        // Models shipped as compressed archives are decoded here on load
+        let modelCacheDirectory = FileManager.default.urls(for: .cachesDirectory, in: .userDomainMask)[0].appendingPathComponent("models")
+        try? FileManager.default.createDirectory(at: modelCacheDirectory, withIntermediateDirectories: true, attributes: nil)
+        if let manager = manager {
+            set_session_spill_dir(manager, sessionsDirectory.path)
+            set_model_cache_dir(manager, modelCacheDirectory.path)
+        }
     }
     
     deinit {
@@ -241,7 +254,13 @@ class ModelManager: NSObject, ObservableObject, URLSessionDownloadDelegate {
                 throw NSError(domain: "ModelManager", code: 6, userInfo: [NSLocalizedDescriptionKey: "Failed to initialize chat template"])
             }
             
+            // Stream captions at a comfortable reading pace instead of flat out
+            setDecodePacing(tokensPerSecond: 15)
+            // Have the capture view's default question answered before it's asked
+            setSpeculativePrompt("Can you describe this image", maxTokens: 128)
+            
             print("Successfully loaded both models")
+            print("Startup stages (name start_ms duration_ms):\n\(startupProfile())")
         } catch {
             print("Failed to load models: \(error)")
             throw NSError(domain: "ModelManager", code: 6, userInfo: [NSLocalizedDescriptionKey: "Failed to load models: \(error.localizedDescription)"])
@@ -462,34 +481,53 @@ class ModelManager: NSObject, ObservableObject, URLSessionDownloadDelegate {
             throw NSError(domain: "ModelManager", code: 8, userInfo: [NSLocalizedDescriptionKey: "Model not loaded"])
         }
         
-        do {
-            // Save image to temporary file
-            let tempDir = FileManager.default.temporaryDirectory
-            let imagePath = tempDir.appendingPathComponent(UUID().uuidString + ".jpg")
-            if let imageData = image.jpegData(compressionQuality: 0.8) {
-                try imageData.write(to: imagePath)
-                
-                print("Processing image at path: \(imagePath.path)")
-                
-                // Process the image
-                guard processImage(path: imagePath.path) else {
-                    print("Failed to process image at path: \(imagePath.path)")
-                    throw NSError(domain: "ModelManager", code: 9, userInfo: [NSLocalizedDescriptionKey: "Failed to process image"])
-                }
-                
-                print("Image processed successfully")
-                
-                // Clean up temporary file
-                try? FileManager.default.removeItem(at: imagePath)
-                
-                return ""  // Return empty string since we're using streaming now
-            } else {
-                throw NSError(domain: "ModelManager", code: 11, userInfo: [NSLocalizedDescriptionKey: "Failed to convert image to JPEG"])
-            }
-        } catch {
-            print("Error processing image: \(error)")
-            throw error
+        // Hand the pixels straight to the core, which converts and downscales them in one pass
+        guard ingestQueue.sync(execute: { ingestImage(image, queue: true, speculate: false) }) else {
+            print("Failed to process image")
+            throw NSError(domain: "ModelManager", code: 9, userInfo: [NSLocalizedDescriptionKey: "Failed to process image"])
+        }
+        
+        print("Image processed successfully")
+        return ""  // Return empty string since we're using streaming now
+    }
+    
+    // Starts encoding a capture in the background so the first prompt about it
+    // doesn't wait for the vision encoder; only captures start the speculative reply
+    func prepareImage(_ image: UIImage) {
+        guard isModelLoaded else { return }
+        ingestQueue.async {
+            _ = self.ingestImage(image, queue: false, speculate: true)
+        }
+    }
+    
+    // Renders the image upright into an RGBX buffer and hands it to the core;
+    // queue adds it to the next prompt, otherwise it is only pre-encoded
+    private func ingestImage(_ image: UIImage, queue: Bool, speculate: Bool) -> Bool {
+        guard let manager = manager else { return false }
+        
+        let width = Int(image.size.width * image.scale)
+        let height = Int(image.size.height * image.scale)
+        guard width > 0, height > 0,
+              let context = CGContext(data: nil,
+                                      width: width,
+                                      height: height,
+                                      bitsPerComponent: 8,
+                                      bytesPerRow: 0,
+                                      space: CGColorSpaceCreateDeviceRGB(),
+                                      bitmapInfo: CGImageAlphaInfo.noneSkipLast.rawValue) else {
+            return false
         }
+        
+        // Drawing through UIKit applies the image orientation
+        UIGraphicsPushContext(context)
+        context.translateBy(x: 0, y: CGFloat(height))
+        context.scaleBy(x: image.scale, y: -image.scale)
+        image.draw(in: CGRect(origin: .zero, size: image.size))
+        UIGraphicsPopContext()
+        
+        guard let data = context.data else { return false }
+        let pixels = data.assumingMemoryBound(to: UInt8.self)
+        return process_image_pixels(manager, pixels, Int32(width), Int32(height), Int32(context.bytesPerRow), queue, speculate)
     }
     
     func loadModelPair(modelName: String) async throws {
@@ -535,8 +573,8 @@ class ModelManager: NSObject, ObservableObject, URLSessionDownloadDelegate {
         return initialize_sampler(manager)
     }
     
-    // This can't be null, the deafult is vicuna
-    func initializeChatTemplate(templateName: String? = "vicuna") -> Bool {
+    // nil uses the model's own template, compiled ahead of time in the core
+    func initializeChatTemplate(templateName: String? = nil) -> Bool {
         guard let manager = manager else { return false }
         return initialize_chat_template(manager, templateName)
     }
@@ -545,6 +583,55 @@ class ModelManager: NSObject, ObservableObject, URLSessionDownloadDelegate {
         guard let manager = manager else { return false }
         return process_image(manager, path)
     }
+
+    // Queues several images for one prompt; they share maxVisualTokens LM tokens (0 = no cap)
+    func processImages(paths: [String], maxVisualTokens: Int = 0) -> Bool {
+        guard let manager = manager else { return false }
+        var cPaths = paths.map { UnsafePointer<CChar>(strdup($0)) }
+        defer { cPaths.forEach { free(UnsafeMutablePointer(mutating: $0)) } }
+        return process_images(manager, &cPaths, Int32(cPaths.count), Int32(maxVisualTokens))
+    }
+    
+    // Drops the chat history and its KV cache so the next prompt starts a new conversation
+    func resetConversation() {
+        guard let manager = manager else { return }
+        reset_conversation(manager)
+    }
+    
+    func setDecodePacing(tokensPerSecond: Float) {
+        guard let manager = manager else { return }
+        set_decode_pacing(manager, tokensPerSecond)
+    }
+
+    // Starts answering prompt as soon as an image is captured; an empty prompt turns it off
+    func setSpeculativePrompt(_ prompt: String, maxTokens: Int) {
+        guard let manager = manager else { return }
+        set_speculative_prompt(manager, prompt, Int32(maxTokens))
+    }
+
+    // Drops an image from the KV cache once a new one arrives or maxTurns turns pass
+    func setImageRetention(maxTurns: Int, summarize: Bool = true) {
+        guard let manager = manager else { return }
+        set_image_retention(manager, Int32(maxTurns), summarize)
+    }
+    
+    // Capabilities usable now: 1 text, 2 image, 4 image encoder warm
+    func readiness() -> Int32 {
+        guard let manager = manager else { return 0 }
+        return get_readiness(manager)
+    }
+    
+    func startupProfile() -> String {
+        guard let manager = manager, let profile = get_startup_profile(manager) else { return "" }
+        defer { free_response(profile) }
+        return String(cString: profile)
+    }
+    
+    // Lets a paced reply run to completion at full speed
+    func finishResponse() {
+        guard let manager = manager else { return }
+        finish_response(manager)
+    }
     
     func generateResponse(prompt: String, maxTokens: Int) -> String? {
         guard let manager = manager else { return nil }
@@ -0,0 +1,109 @@
+#include "async_file_reader.h"
+#include "file_io.h"
+#include "model_manager.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+AsyncFileReader::AsyncFileReader(int n_threads, size_t max_buffered)
+    : max_buffered(max_buffered > 0 ? max_buffered : 1) {
+    for (int i = 0; i < std::max(n_threads, 1); i++) {
+        threads.emplace_back(&AsyncFileReader::worker, this);
+    }
+}
+
+AsyncFileReader::~AsyncFileReader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void AsyncFileReader::submit(size_t index, const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back({index, path});
+        n_outstanding++;
+    }
+    work_cv.notify_one();
+}
+
+bool AsyncFileReader::next(Completion& out) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (n_outstanding == 0) {
+        return false;
+    }
+    done_cv.wait(lock, [this]() { return !completed.empty(); });
+    out = std::move(completed.front());
+    completed.pop_front();
+    n_outstanding--;
+    lock.unlock();
+
+    // A buffer slot was freed
+    work_cv.notify_one();
+    return true;
+}
+
+void AsyncFileReader::recycle(std::vector<uint8_t>&& buffer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pool.size() < max_buffered) {
+        buffer.clear();
+        pool.push_back(std::move(buffer));
+    }
+}
+
+void AsyncFileReader::worker() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        work_cv.wait(lock, [this]() {
+            return stopping || (!pending.empty() && completed.size() + n_reading < max_buffered);
+        });
+        if (stopping) {
+            return;
+        }
+        Request request = std::move(pending.front());
+        pending.pop_front();
+        n_reading++;
+
+        Completion completion;
+        completion.index = request.index;
+        if (!pool.empty()) {
+            completion.data = std::move(pool.back());
+            pool.pop_back();
+        }
+        lock.unlock();
+
+        completion.ok = readFile(request.path, completion.data);
+        if (!completion.ok) {
+            LOGe("Failed to read %s", request.path.c_str());
+        }
+
+        lock.lock();
+        n_reading--;
+        completed.push_back(std::move(completion));
+        done_cv.notify_one();
+    }
+}
+
+bool AsyncFileReader::readFile(const std::string& path, std::vector<uint8_t>& data) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    data.resize((size_t)st.st_size);
+
+    // One large read; network filesystems return short counts, which preadAll retries
+    bool ok = preadAll(fd, data.data(), data.size(), 0);
+    close(fd);
+    return ok;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reads whole files on a small I/O thread pool into pooled buffers, keeping
+// several reads in flight so storage latency on cold or network-backed
+// archives overlaps with decode and encode work. Completions are delivered
+// in the order they finish, not the order they were submitted. At most
+// max_buffered files are read ahead of the consumer.
+class AsyncFileReader {
+public:
+    struct Completion {
+        size_t index = 0;
+        bool ok = false;
+        std::vector<uint8_t> data;
+    };
+
+    explicit AsyncFileReader(int n_threads = 4, size_t max_buffered = 8);
+    ~AsyncFileReader();
+    AsyncFileReader(const AsyncFileReader&) = delete;
+    AsyncFileReader& operator=(const AsyncFileReader&) = delete;
+
+    void submit(size_t index, const std::string& path);
+
+    // Blocks for the next finished read; returns false once everything submitted was returned
+    bool next(Completion& out);
+
+    // Hands a consumed buffer back for reuse by later reads
+    void recycle(std::vector<uint8_t>&& buffer);
+
+private:
+    struct Request {
+        size_t index;
+        std::string path;
+    };
+
+    void worker();
+    bool readFile(const std::string& path, std::vector<uint8_t>& data);
+
+    std::mutex mutex;
+    std::condition_variable work_cv;  // requests queued or buffer space freed
+    std::condition_variable done_cv;  // completion ready
+    std::deque<Request> pending;
+    std::deque<Completion> completed;
+    std::vector<std::vector<uint8_t>> pool;
+    size_t max_buffered;
+    size_t n_reading = 0;
+    size_t n_outstanding = 0;  // submitted but not yet returned by next()
+    bool stopping = false;
+    std::vector<std::thread> threads;
+};
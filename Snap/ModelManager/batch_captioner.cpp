@@ -0,0 +1,102 @@
+#include "batch_captioner.h"
+#include "async_file_reader.h"
+#include "model_manager.h"
+#include "perceptual_hash.h"
+
+int BatchCaptioner::match(uint64_t hash, const std::vector<uint64_t>& hashes,
+                          const std::vector<int>& representatives) const {
+    // Greedy: join the first representative within the threshold. Bursts are
+    // consecutive, so checking the newest representatives first finds them fast.
+    if (dedup_threshold < 0) {
+        return -1;
+    }
+    for (auto it = representatives.rbegin(); it != representatives.rend(); ++it) {
+        if (hashDistance(hash, hashes[*it]) <= dedup_threshold) {
+            return *it;
+        }
+    }
+    return -1;
+}
+
+bool BatchCaptioner::run(const std::vector<std::string>& paths, const char* prompt, int max_tokens,
+                         Result& result, ItemCallback callback) {
+    result = Result();
+    if (paths.empty()) {
+        return true;
+    }
+    int64_t t_start_us = ggml_time_us();
+
+    // Captions are generated in a session of their own, closed on every exit
+    struct SessionScope {
+        ModelManager& manager;
+        int id;
+        ~SessionScope() { manager.closeSession(id); }
+    } session{manager, manager.createSession()};
+
+    bool use_shared_prefix = shared_prefix && manager.beginSharedPrompt(session.id, prompt);
+
+    // One pass: each image is decoded once as its read completes, hashed, and
+    // either joins an earlier representative or is captioned from the same
+    // pixels right away. Later files are read ahead meanwhile.
+    std::vector<uint64_t> hashes(paths.size(), 0);
+    std::vector<int> representatives;
+    result.cluster.assign(paths.size(), -1);
+    result.captions.assign(paths.size(), std::string());
+    AsyncFileReader reader;
+    for (size_t i = 0; i < paths.size(); i++) {
+        reader.submit(i, paths[i]);
+    }
+
+    AsyncFileReader::Completion read;
+    while (reader.next(read)) {
+        size_t i = read.index;
+        mtmd::bitmap decoded;
+        if (read.ok) {
+            decoded.ptr.reset(mtmd_helper_bitmap_init_from_buf(read.data.data(), read.data.size()));
+        }
+        reader.recycle(std::move(read.data));
+        if (!decoded.ptr) {
+            LOGe("Failed to load image from %s", paths[i].c_str());
+            result.cluster[i] = (int)i;
+            if (callback) {
+                callback(i, i, std::string());
+            }
+            continue;
+        }
+
+        hashes[i] = perceptualHash(decoded.data(), decoded.nx(), decoded.ny(), decoded.nx() * 3, 3);
+        int representative = match(hashes[i], hashes, representatives);
+        if (representative >= 0) {
+            result.cluster[i] = representative;
+            result.captions[i] = result.captions[representative];
+            if (callback) {
+                callback(i, representative, result.captions[i]);
+            }
+            continue;
+        }
+
+        result.cluster[i] = (int)i;
+        representatives.push_back((int)i);
+        std::string caption;
+        if (!use_shared_prefix) {
+            manager.resetConversation(session.id);
+        }
+        if (manager.processImagePixels(session.id, decoded.data(), decoded.nx(), decoded.ny(), decoded.nx() * 3, 3)) {
+            auto collect = [&caption](const std::string& token) { caption += token; };
+            bool ok = use_shared_prefix ? manager.generateSharedPrompt(session.id, max_tokens, collect)
+                                        : manager.generateResponse(session.id, prompt, max_tokens, collect);
+            if (ok) {
+                result.n_generated++;
+            }
+        }
+        manager.clearBitmaps(session.id);
+        result.captions[i] = caption;
+        if (callback) {
+            callback(i, i, caption);
+        }
+    }
+
+    LOGi("Batch of %zu images captioned with %zu generations in %lld ms", paths.size(), result.n_generated,
+         (long long)(ggml_time_us() - t_start_us) / 1000);
+    return true;
+}
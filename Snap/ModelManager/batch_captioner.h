@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+class ModelManager;
+
+// Batch captioning over image files, run in its own session. Near-duplicate
+// images are clustered by perceptual hash as they are read; the VLM runs
+// once per cluster and the answer is fanned out to every member.
+class BatchCaptioner {
+public:
+    struct Result {
+        std::vector<int> cluster;           // index of each input's representative
+        std::vector<std::string> captions;  // per input, copied from its representative
+        size_t n_generated = 0;             // clusters actually run through the model
+    };
+    // Called once per input: for a representative once it is captioned, for
+    // a member as soon as it is matched. Inputs are visited as their reads
+    // complete, so the first image of a cluster to arrive represents it.
+    using ItemCallback = std::function<void(size_t index, size_t representative, const std::string& caption)>;
+
+    explicit BatchCaptioner(ModelManager& manager) : manager(manager) {}
+
+    // Max hash distance in bits for two images to share a caption; negative disables
+    void setDedupThreshold(int bits) { dedup_threshold = bits; }
+
+    // Put the prompt before the image and prefill it once for the whole batch
+    void setSharedPrefix(bool enabled) { shared_prefix = enabled; }
+
+    bool run(const std::vector<std::string>& paths, const char* prompt, int max_tokens,
+             Result& result, ItemCallback callback = nullptr);
+
+private:
+    ModelManager& manager;
+    int dedup_threshold = 6;
+    bool shared_prefix = true;
+
+    // Representative within the threshold of hash, -1 for none
+    int match(uint64_t hash, const std::vector<uint64_t>& hashes, const std::vector<int>& representatives) const;
+};
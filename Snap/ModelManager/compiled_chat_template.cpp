@@ -0,0 +1,196 @@
+#include "compiled_chat_template.h"
+#include "model_manager.h"
+#include <exception>
+
+namespace {
+
+const char* const kRoleNames[] = {"system", "user", "assistant"};
+
+common_chat_msg makeMsg(const char* role, const std::string& content) {
+    common_chat_msg msg;
+    msg.role = role;
+    msg.content = content;
+    return msg;
+}
+
+std::string sentinel(size_t i) {
+    return "SNAPPROBE" + std::to_string(i) + "X";
+}
+
+// Renders through the Jinja interpreter; templates may throw on shapes they reject
+bool renderReference(const common_chat_templates* tmpls, const std::vector<common_chat_msg>& msgs,
+                     bool add_generation_prompt, std::string& out) {
+    common_chat_templates_inputs tmpl_inputs;
+    tmpl_inputs.messages = msgs;
+    tmpl_inputs.add_generation_prompt = add_generation_prompt;
+    tmpl_inputs.use_jinja = true;
+    try {
+        out = common_chat_templates_apply(tmpls, tmpl_inputs).prompt;
+    } catch (const std::exception& e) {
+        LOGi("Chat template probe rejected: %s", e.what());
+        return false;
+    }
+    return true;
+}
+
+// Renders a probe transcript whose contents are sentinels and splits the
+// output around them; each sentinel must appear exactly once, in order
+bool probe(const common_chat_templates* tmpls, const std::vector<const char*>& roles,
+           bool add_generation_prompt, std::vector<std::string>& parts) {
+    std::vector<common_chat_msg> msgs;
+    for (size_t i = 0; i < roles.size(); i++) {
+        msgs.push_back(makeMsg(roles[i], sentinel(i)));
+    }
+    std::string text;
+    if (!renderReference(tmpls, msgs, add_generation_prompt, text)) {
+        return false;
+    }
+
+    parts.clear();
+    size_t pos = 0;
+    for (size_t i = 0; i < roles.size(); i++) {
+        std::string s = sentinel(i);
+        size_t found = text.find(s, pos);
+        if (found == std::string::npos || text.find(s, found + s.size()) != std::string::npos) {
+            return false;
+        }
+        parts.push_back(text.substr(pos, found - pos));
+        pos = found + s.size();
+    }
+    parts.push_back(text.substr(pos));
+    return true;
+}
+
+} // namespace
+
+int CompiledChatTemplate::roleIndex(const std::string& role) {
+    for (int i = 0; i < N_ROLES; i++) {
+        if (role == kRoleNames[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+std::unique_ptr<CompiledChatTemplate> CompiledChatTemplate::compile(const common_chat_templates* tmpls) {
+    if (!tmpls) {
+        return nullptr;
+    }
+
+    std::unique_ptr<CompiledChatTemplate> tmpl(new CompiledChatTemplate());
+    std::vector<std::string> parts, parts_gen;
+
+    // A single user turn gives the lead-in and both tails for user
+    if (!probe(tmpls, {"user"}, false, parts) || !probe(tmpls, {"user"}, true, parts_gen) ||
+        parts[0] != parts_gen[0]) {
+        LOGi("Chat template can't be compiled: single user turn is not literal");
+        return nullptr;
+    }
+    tmpl->lead[ROLE_USER] = parts[0];
+    tmpl->has_lead[ROLE_USER] = true;
+    tmpl->tail[ROLE_USER] = parts[1];
+    tmpl->tail_gen[ROLE_USER] = parts_gen[1];
+    tmpl->has_tail[ROLE_USER] = true;
+
+    // user -> assistant, and the tails after an assistant reply
+    if (!probe(tmpls, {"user", "assistant"}, false, parts) ||
+        !probe(tmpls, {"user", "assistant"}, true, parts_gen) ||
+        parts[0] != tmpl->lead[ROLE_USER] || parts[1] != parts_gen[1]) {
+        LOGi("Chat template can't be compiled: assistant turn is not literal");
+        return nullptr;
+    }
+    tmpl->between[ROLE_USER][ROLE_ASSISTANT] = parts[1];
+    tmpl->has_between[ROLE_USER][ROLE_ASSISTANT] = true;
+    tmpl->tail[ROLE_ASSISTANT] = parts[2];
+    tmpl->tail_gen[ROLE_ASSISTANT] = parts_gen[2];
+    tmpl->has_tail[ROLE_ASSISTANT] = true;
+
+    // assistant -> user
+    if (!probe(tmpls, {"user", "assistant", "user"}, true, parts) ||
+        parts[0] != tmpl->lead[ROLE_USER] || parts[1] != tmpl->between[ROLE_USER][ROLE_ASSISTANT] ||
+        parts[3] != tmpl->tail_gen[ROLE_USER]) {
+        LOGi("Chat template can't be compiled: follow-up user turn is not literal");
+        return nullptr;
+    }
+    tmpl->between[ROLE_ASSISTANT][ROLE_USER] = parts[2];
+    tmpl->has_between[ROLE_ASSISTANT][ROLE_USER] = true;
+
+    // System prompts are optional; plenty of templates reject or fold them
+    if (probe(tmpls, {"system", "user"}, true, parts) && parts[2] == tmpl->tail_gen[ROLE_USER]) {
+        tmpl->lead[ROLE_SYSTEM] = parts[0];
+        tmpl->has_lead[ROLE_SYSTEM] = true;
+        tmpl->between[ROLE_SYSTEM][ROLE_USER] = parts[1];
+        tmpl->has_between[ROLE_SYSTEM][ROLE_USER] = true;
+    }
+
+    // Validate on transcripts shaped like the ones we actually send
+    std::vector<std::vector<common_chat_msg>> checks = {
+        {makeMsg("user", " <__image__> Can you describe this image")},
+        {makeMsg("user", "Hello"),
+         makeMsg("assistant", "Hi there!\nHow can I help?"),
+         makeMsg("user", " <__image__> What is in it? ")},
+        {makeMsg("user", "first"),
+         makeMsg("assistant", " reply "),
+         makeMsg("user", "second"),
+         makeMsg("assistant", "another reply")},
+    };
+    if (tmpl->has_lead[ROLE_SYSTEM]) {
+        checks.push_back({makeMsg("system", "You are a helpful assistant."),
+                          makeMsg("user", "Hi"),
+                          makeMsg("assistant", "Hello"),
+                          makeMsg("user", "Bye")});
+    }
+    std::string expected, actual;
+    for (const auto& msgs : checks) {
+        for (bool add_generation_prompt : {false, true}) {
+            if (!renderReference(tmpls, msgs, add_generation_prompt, expected) ||
+                !tmpl->render(msgs, add_generation_prompt, actual) || expected != actual) {
+                LOGi("Chat template can't be compiled: output differs from the interpreter");
+                return nullptr;
+            }
+        }
+    }
+
+    return tmpl;
+}
+
+bool CompiledChatTemplate::render(const std::vector<common_chat_msg>& msgs, bool add_generation_prompt,
+                                  std::string& out) const {
+    out.clear();
+    if (msgs.empty()) {
+        return true;
+    }
+
+    // Resolve every literal first so the output is sized exactly once
+    std::vector<const std::string*> pieces;
+    pieces.reserve(msgs.size() * 2 + 1);
+    int prev = roleIndex(msgs[0].role);
+    if (prev < 0 || !has_lead[prev]) {
+        return false;
+    }
+    pieces.push_back(&lead[prev]);
+    pieces.push_back(&msgs[0].content);
+    for (size_t i = 1; i < msgs.size(); i++) {
+        int role = roleIndex(msgs[i].role);
+        if (role < 0 || !has_between[prev][role]) {
+            return false;
+        }
+        pieces.push_back(&between[prev][role]);
+        pieces.push_back(&msgs[i].content);
+        prev = role;
+    }
+    if (!has_tail[prev]) {
+        return false;
+    }
+    pieces.push_back(add_generation_prompt ? &tail_gen[prev] : &tail[prev]);
+
+    size_t size = 0;
+    for (const std::string* piece : pieces) {
+        size += piece->size();
+    }
+    out.reserve(size);
+    for (const std::string* piece : pieces) {
+        out += *piece;
+    }
+    return true;
+}
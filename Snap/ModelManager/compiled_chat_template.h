@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include "chat.h"
+
+// Chat template renderer specialised ahead of time from the model's Jinja
+// template. The template is probed once through the reference interpreter to
+// extract the literal text it places around each role's content, so rendering
+// a transcript is plain concatenation into a single pre-sized string. A
+// renderer is only produced if it reproduces the interpreter's output exactly
+// on a set of validation transcripts.
+class CompiledChatTemplate {
+public:
+    // Returns nullptr if the template can't be reduced to per-role literals
+    static std::unique_ptr<CompiledChatTemplate> compile(const common_chat_templates* tmpls);
+
+    // Returns false for transcript shapes the template was not compiled for
+    bool render(const std::vector<common_chat_msg>& msgs, bool add_generation_prompt, std::string& out) const;
+
+private:
+    CompiledChatTemplate() = default;
+
+    enum Role { ROLE_SYSTEM, ROLE_USER, ROLE_ASSISTANT, N_ROLES };
+    static int roleIndex(const std::string& role);
+
+    // Text before the first message, keyed by its role
+    std::array<std::string, N_ROLES> lead;
+    std::array<bool, N_ROLES> has_lead{};
+
+    // Text between the content of two consecutive messages
+    std::array<std::array<std::string, N_ROLES>, N_ROLES> between;
+    std::array<std::array<bool, N_ROLES>, N_ROLES> has_between{};
+
+    // Text after the last message, without and with the generation prompt
+    std::array<std::string, N_ROLES> tail;
+    std::array<std::string, N_ROLES> tail_gen;
+    std::array<bool, N_ROLES> has_tail{};
+};
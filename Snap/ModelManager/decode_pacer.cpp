@@ -0,0 +1,47 @@
+#include "decode_pacer.h"
+
+void DecodePacer::begin(float tokens_per_second) {
+    std::lock_guard<std::mutex> lock(mutex);
+    rate = tokens_per_second;
+    active = rate > 0.0f;
+    ahead = false;
+    n_tokens = 0;
+    start = std::chrono::steady_clock::now();
+}
+
+void DecodePacer::afterToken() {
+    std::unique_lock<std::mutex> lock(mutex);
+    n_tokens++;
+    if (!active || finish) {
+        ahead = false;
+        return;
+    }
+
+    auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(n_tokens / rate));
+    ahead = std::chrono::steady_clock::now() < due;
+    if (ahead) {
+        cv.wait_until(lock, due, [this]() { return finish; });
+        ahead = !finish;
+    }
+}
+
+void DecodePacer::end() {
+    std::lock_guard<std::mutex> lock(mutex);
+    active = false;
+    ahead = false;
+    finish = false;
+}
+
+bool DecodePacer::lowPower() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return active && ahead && !finish;
+}
+
+void DecodePacer::finishNow() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finish = true;
+    }
+    cv.notify_all();
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+// Paces one session's streamed reply to a target output rate. afterToken()
+// sleeps until the next token is due and is called with no model step
+// pending, so the wait never holds up other sessions. While the reply is
+// ahead of schedule its steps can run at low power (a single thread); once
+// it falls behind they run at full speed. A consumer that wants the whole
+// result calls finishNow() to drop the pacing mid-reply.
+class DecodePacer {
+public:
+    // Tokens per second; zero or negative disables pacing
+    void begin(float tokens_per_second);
+    void afterToken();
+    void end();
+    // The reply is ahead of schedule, so its next step needn't run at full speed
+    bool lowPower();
+
+    // Safe to call from any thread. Called before the reply begins, it
+    // applies to that reply; it lasts until the reply ends.
+    void finishNow();
+
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    float rate = 0.0f;
+    bool finish = false;
+    bool active = false;  // pacing this reply
+    bool ahead = false;
+    int n_tokens = 0;
+    std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,59 @@
+#include "encode_worker.h"
+
+void EncodeWorker::start(EncodeFn fn) {
+    stop();
+    this->fn = std::move(fn);
+    stopping = false;
+    worker = std::thread(&EncodeWorker::run, this);
+}
+
+void EncodeWorker::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void EncodeWorker::submit(mtmd::bitmap&& bmp) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(std::move(bmp));
+    }
+    cv.notify_all();
+}
+
+void EncodeWorker::waitIdle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!worker.joinable()) {
+        return;
+    }
+    idle_cv.wait(lock, [this]() { return (pending.empty() && !busy) || stopping; });
+}
+
+void EncodeWorker::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cv.wait(lock, [this]() { return !pending.empty() || stopping; });
+        if (stopping) {
+            break;
+        }
+
+        mtmd::bitmap bmp(std::move(pending.front()));
+        pending.pop_front();
+        busy = true;
+
+        lock.unlock();
+        fn(bmp);
+        lock.lock();
+
+        busy = false;
+        if (pending.empty()) {
+            idle_cv.notify_all();
+        }
+    }
+    idle_cv.notify_all();
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "mtmd.h"
+
+// Persistent vision encode worker. Submitted images are encoded one at a
+// time in submission order, so a submission never waits for the encoder.
+// There is no batching window: mtmd encodes one image per call, so images
+// gathered into a batch would still be encoded back to back.
+class EncodeWorker {
+public:
+    using EncodeFn = std::function<void(mtmd::bitmap& bmp)>;
+
+    EncodeWorker() = default;
+    EncodeWorker(const EncodeWorker&) = delete;
+    EncodeWorker& operator=(const EncodeWorker&) = delete;
+    ~EncodeWorker() { stop(); }
+
+    void start(EncodeFn fn);
+    void stop();
+
+    // Never blocks on the encoder
+    void submit(mtmd::bitmap&& bmp);
+    // Returns once everything submitted so far is encoded
+    void waitIdle();
+
+private:
+    void run();
+
+    EncodeFn fn;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::condition_variable idle_cv;
+    std::deque<mtmd::bitmap> pending;  // bitmaps move-construct but not move-assign
+    bool busy = false;
+    bool stopping = false;
+};
@@ -0,0 +1,154 @@
+#include "fair_scheduler.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const size_t kLatencyWindow = 512;
+// Priority a waiting session gains per step, in predicted reply tokens
+const int kAgingTokens = 16;
+
+}  // namespace
+
+void FairScheduler::setPrefillChunk(int tokens) {
+    std::lock_guard<std::mutex> lock(mutex);
+    prefill_chunk = std::max(tokens, 1);
+}
+
+void FairScheduler::setWeight(int session, float weight) {
+    std::lock_guard<std::mutex> lock(mutex);
+    flows[session].weight = std::max(weight, 0.01f);
+}
+
+// mutex must be held. Each demand is credited its weighted part of the
+// budget and granted up to its credit; what demand-limited sessions leave
+// goes to the others in order, charged to their deficit.
+int FairScheduler::share(const std::vector<Demand>& demands, const std::vector<size_t>& order, int budget,
+                         std::vector<int>& grants) {
+    if (order.empty() || budget <= 0) {
+        return budget;
+    }
+    double total_weight = 0.0;
+    for (size_t i : order) {
+        total_weight += flows[demands[i].session].weight;
+    }
+    int left = budget;
+    for (size_t i : order) {
+        Flow& flow = flows[demands[i].session];
+        flow.deficit = std::min(flow.deficit + budget * flow.weight / total_weight, (double)budget);
+        int grant = std::min({demands[i].n_tokens, (int)std::floor(flow.deficit), left});
+        grants[i] = std::max(grant, 0);
+        left -= grants[i];
+    }
+    for (size_t i : order) {
+        int extra = std::min(demands[i].n_tokens - grants[i], left);
+        if (extra > 0) {
+            grants[i] += extra;
+            left -= extra;
+        }
+    }
+    for (size_t i : order) {
+        Flow& flow = flows[demands[i].session];
+        flow.deficit = std::max(flow.deficit - grants[i], -(double)budget);
+        if (grants[i] == demands[i].n_tokens) {
+            flow.deficit = std::min(flow.deficit, 0.0);  // unused credit isn't banked
+        }
+    }
+    return left;
+}
+
+std::vector<int> FairScheduler::plan(const std::vector<Demand>& demands, int n_batch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<int> grants(demands.size(), 0);
+    int budget = std::max(n_batch, 1);
+
+    // Shortest predicted reply first, aged by the steps waited
+    auto byPriority = [&](std::vector<size_t>& order) {
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            int ka = demands[a].expected - flows[demands[a].session].waited * kAgingTokens;
+            int kb = demands[b].expected - flows[demands[b].session].waited * kAgingTokens;
+            return ka < kb;
+        });
+    };
+
+    std::vector<size_t> decoders;
+    std::vector<size_t> prefills;
+    std::vector<size_t> background;
+    for (size_t i = 0; i < demands.size(); i++) {
+        if (demands[i].n_tokens <= 0) {
+            continue;
+        }
+        if (demands[i].background) {
+            background.push_back(i);
+        } else if (demands[i].decode) {
+            decoders.push_back(i);
+        } else {
+            prefills.push_back(i);
+        }
+    }
+    byPriority(decoders);
+    byPriority(prefills);
+    byPriority(background);
+
+    for (size_t i : decoders) {
+        if (budget > 0) {
+            grants[i] = 1;
+            budget--;
+        }
+    }
+    int prefill_budget = decoders.empty() ? budget : std::min(budget, prefill_chunk);
+    int prefill_left = share(demands, prefills, prefill_budget, grants);
+    budget -= prefill_budget - prefill_left;
+
+    // Background work gets what foreground prefill leaves of its budget, or a
+    // token each alongside it
+    int background_budget = prefills.empty() ? prefill_left : std::min(budget, (int)background.size());
+    share(demands, background, background_budget, grants);
+
+    for (size_t i = 0; i < demands.size(); i++) {
+        if (demands[i].n_tokens > 0) {
+            Flow& flow = flows[demands[i].session];
+            flow.waited = grants[i] > 0 ? 0 : flow.waited + 1;
+        }
+    }
+    return grants;
+}
+
+void FairScheduler::recordTokenGap(int session, double ms) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Flow& flow = flows[session];
+    if (flow.gaps.size() < kLatencyWindow) {
+        flow.gaps.push_back((float)ms);
+    } else {
+        flow.gaps[flow.next_gap] = (float)ms;
+        flow.next_gap = (flow.next_gap + 1) % kLatencyWindow;
+    }
+}
+
+FairScheduler::LatencyStats FairScheduler::latency(int session) {
+    std::vector<float> gaps;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = flows.find(session);
+        if (it != flows.end()) {
+            gaps = it->second.gaps;
+        }
+    }
+    LatencyStats stats;
+    if (gaps.empty()) {
+        return stats;
+    }
+    std::sort(gaps.begin(), gaps.end());
+    auto at = [&](int pct) { return gaps[std::min(gaps.size() - 1, gaps.size() * pct / 100)]; };
+    stats.n = (int)gaps.size();
+    stats.p50_ms = at(50);
+    stats.p95_ms = at(95);
+    stats.p99_ms = at(99);
+    stats.max_ms = gaps.back();
+    return stats;
+}
+
+void FairScheduler::forget(int session) {
+    std::lock_guard<std::mutex> lock(mutex);
+    flows.erase(session);
+}
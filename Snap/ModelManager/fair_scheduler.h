@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Splits each batched decode step between the sessions that have tokens
+// ready. Every session generating a reply gets its next token in every
+// step, so replies advance together. Prefill shares what is left: at most
+// prefill_chunk tokens while anyone is generating, the whole batch
+// otherwise. The prefill share is split by weight, with each session's
+// rounding carried over as deficit so small budgets stay fair over time.
+// Within a step, sessions whose reply is predicted to be shorter are
+// served first, aged by the steps they waited without a grant so long
+// replies aren't starved. Background work (speculation) only gets what no
+// foreground session wants.
+class FairScheduler {
+public:
+    struct Demand {
+        int session = 0;
+        int n_tokens = 0;        // ready to evaluate
+        bool decode = false;     // a reply token rather than prefill
+        int expected = 0;        // predicted reply tokens still to come
+        bool background = false;
+    };
+
+    struct LatencyStats {
+        int n = 0;  // token gaps in the window
+        double p50_ms = 0.0;
+        double p95_ms = 0.0;
+        double p99_ms = 0.0;
+        double max_ms = 0.0;
+    };
+
+    void setPrefillChunk(int tokens);
+    void setWeight(int session, float weight);
+
+    // Tokens granted to each demand in a step of at most n_batch tokens
+    std::vector<int> plan(const std::vector<Demand>& demands, int n_batch);
+
+    // Inter-token latency of each session, over its recent tokens
+    void recordTokenGap(int session, double ms);
+    LatencyStats latency(int session);
+    void forget(int session);
+
+private:
+    struct Flow {
+        float weight = 1.0f;
+        double deficit = 0.0;
+        int waited = 0;           // steps with a demand but no grant
+        std::vector<float> gaps;  // ring of recent inter-token gaps
+        size_t next_gap = 0;
+    };
+
+    // Splits budget over the demands in order; returns what is left
+    int share(const std::vector<Demand>& demands, const std::vector<size_t>& order, int budget,
+              std::vector<int>& grants);
+
+    std::mutex mutex;
+    std::map<int, Flow> flows;
+    int prefill_chunk = 64;
+};
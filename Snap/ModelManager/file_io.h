@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Positional reads and writes that retry short transfers and EINTR
+inline bool preadAll(int fd, void* buf, size_t len, off_t offset) {
+    uint8_t* dst = static_cast<uint8_t*>(buf);
+    while (len > 0) {
+        ssize_t n = pread(fd, dst, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        dst += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return true;
+}
+
+inline bool pwriteAll(int fd, const void* buf, size_t len, off_t offset) {
+    const uint8_t* src = static_cast<const uint8_t*>(buf);
+    while (len > 0) {
+        ssize_t n = pwrite(fd, src, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        src += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return true;
+}
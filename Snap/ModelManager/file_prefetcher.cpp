@@ -0,0 +1,71 @@
+#include "file_prefetcher.h"
+#include "file_io.h"
+#include "model_manager.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool FilePrefetcher::start(const char* path, int n_threads, size_t chunk_bytes) {
+    wait();
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOGe("Failed to open %s for prefetch", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    this->path = path;
+    size = (size_t)st.st_size;
+    // Page-aligned chunks keep every read on whole pages
+    const size_t page = (size_t)getpagesize();
+    chunk = std::max(page, chunk_bytes - chunk_bytes % page);
+    next_chunk = 0;
+    failed = false;
+    t_start_us = ggml_time_us();
+    for (int i = 0; i < std::max(n_threads, 1); i++) {
+        threads.emplace_back(&FilePrefetcher::worker, this);
+    }
+    return true;
+}
+
+bool FilePrefetcher::wait() {
+    if (threads.empty()) {
+        return true;
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+    close(fd);
+    fd = -1;
+
+    double seconds = (ggml_time_us() - t_start_us) / 1e6;
+    LOGi("Prefetched %s: %zu MB in %.2f s (%.0f MB/s)", path.c_str(), size >> 20, seconds,
+         seconds > 0 ? (size >> 20) / seconds : 0.0);
+    return !failed;
+}
+
+void FilePrefetcher::worker() {
+    void* scratch = nullptr;
+    if (posix_memalign(&scratch, (size_t)getpagesize(), chunk) != 0) {
+        failed = true;
+        return;
+    }
+    while (!failed) {
+        size_t offset = next_chunk++ * chunk;
+        if (offset >= size) {
+            break;
+        }
+        size_t end = std::min(size, offset + chunk);
+        if (!preadAll(fd, scratch, end - offset, (off_t)offset)) {
+            failed = true;
+        }
+    }
+    free(scratch);
+}
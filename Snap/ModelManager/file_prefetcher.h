@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Pulls a file into the page cache with several threads issuing large
+// aligned preads, so a cold model file is read at the device's bandwidth
+// instead of one mmap page fault at a time. llama.cpp's mmap load then
+// faults from memory.
+class FilePrefetcher {
+public:
+    FilePrefetcher() = default;
+    FilePrefetcher(const FilePrefetcher&) = delete;
+    FilePrefetcher& operator=(const FilePrefetcher&) = delete;
+    ~FilePrefetcher() { wait(); }
+
+    // Returns immediately; reads run until wait()
+    bool start(const char* path, int n_threads = 4, size_t chunk_bytes = 8u << 20);
+    // Returns false if any read failed; true when nothing was started
+    bool wait();
+
+private:
+    void worker();
+
+    std::string path;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next_chunk{0};
+    std::atomic<bool> failed{false};
+    int fd = -1;
+    size_t size = 0;
+    size_t chunk = 0;
+    int64_t t_start_us = 0;
+};
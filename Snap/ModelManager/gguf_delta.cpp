@@ -0,0 +1,337 @@
+#include "gguf_delta.h"
+#include "file_io.h"
+#include "model_manager.h"
+#include "gguf.h"
+#include <CommonCrypto/CommonDigest.h>
+#include <algorithm>
+#include <compression.h>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const char kMagic[4] = {'S', 'N', 'P', 'D'};
+const uint32_t kVersion = 1;
+// Ops carry at most this many target bytes, bounding memory on both sides
+const size_t kPiece = 4u << 20;
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint8_t base_hash[CC_SHA256_DIGEST_LENGTH];
+    uint8_t target_hash[CC_SHA256_DIGEST_LENGTH];
+    uint64_t target_size;
+    uint64_t n_ops;
+};
+
+enum OpKind : uint32_t { OP_COPY = 0, OP_DATA = 1, OP_XOR = 2 };
+
+// Followed by packed_len payload bytes for DATA and XOR; the payload is
+// stored raw when packed_len == len
+struct Op {
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t len;
+    uint64_t base_offset;
+    uint64_t packed_len;
+};
+
+bool hashFile(int fd, uint8_t* digest) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return false;
+    }
+    CC_SHA256_CTX sha;
+    CC_SHA256_Init(&sha);
+    std::vector<uint8_t> buf(kPiece);
+    for (uint64_t offset = 0; offset < (uint64_t)st.st_size; offset += buf.size()) {
+        size_t n = (size_t)std::min<uint64_t>(buf.size(), (uint64_t)st.st_size - offset);
+        if (!preadAll(fd, buf.data(), n, (off_t)offset)) {
+            return false;
+        }
+        CC_SHA256_Update(&sha, buf.data(), (CC_LONG)n);
+    }
+    CC_SHA256_Final(digest, &sha);
+    return true;
+}
+
+struct TensorRange {
+    uint64_t offset;
+    uint64_t size;
+};
+
+bool readTensors(const char* path, std::vector<std::pair<std::string, TensorRange>>& tensors) {
+    gguf_init_params params = {true, nullptr};
+    gguf_context* ctx = gguf_init_from_file(path, params);
+    if (!ctx) {
+        return false;
+    }
+    size_t data_offset = gguf_get_data_offset(ctx);
+    for (int64_t i = 0; i < gguf_get_n_tensors(ctx); i++) {
+        TensorRange range = {data_offset + gguf_get_tensor_offset(ctx, i), gguf_get_tensor_size(ctx, i)};
+        tensors.emplace_back(gguf_get_tensor_name(ctx, i), range);
+    }
+    gguf_free(ctx);
+    return true;
+}
+
+class DeltaWriter {
+public:
+    DeltaWriter(int base_fd, int target_fd, int delta_fd) : base_fd(base_fd), target_fd(target_fd), delta_fd(delta_fd) {
+        target.resize(kPiece);
+        base.resize(kPiece);
+        packed.resize(kPiece);
+    }
+
+    // Target bytes with no counterpart in the base
+    bool data(uint64_t offset, uint64_t len) {
+        for (uint64_t done = 0; done < len; done += kPiece) {
+            size_t n = std::min<uint64_t>(kPiece, len - done);
+            if (!preadAll(target_fd, target.data(), n, (off_t)(offset + done)) || !emit(OP_DATA, 0, n)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Target bytes with a same-sized counterpart in the base
+    bool tensor(uint64_t offset, uint64_t base_offset, uint64_t len) {
+        for (uint64_t done = 0; done < len; done += kPiece) {
+            size_t n = std::min<uint64_t>(kPiece, len - done);
+            if (!preadAll(target_fd, target.data(), n, (off_t)(offset + done)) ||
+                !preadAll(base_fd, base.data(), n, (off_t)(base_offset + done))) {
+                return false;
+            }
+            if (memcmp(target.data(), base.data(), n) == 0) {
+                if (!copy(base_offset + done, n)) {
+                    return false;
+                }
+                continue;
+            }
+            for (size_t i = 0; i < n; i++) {
+                target[i] ^= base[i];
+            }
+            if (!emit(OP_XOR, base_offset + done, n)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool finish() { return flushCopy(); }
+
+    uint64_t n_ops = 0;
+    uint64_t copied = 0;
+    off_t pos = sizeof(Header);
+
+private:
+    // Contiguous copies are merged into one op
+    bool copy(uint64_t base_offset, uint64_t len) {
+        if (pending_copy.len > 0 && pending_copy.base_offset + pending_copy.len == base_offset) {
+            pending_copy.len += len;
+            return true;
+        }
+        if (!flushCopy()) {
+            return false;
+        }
+        pending_copy = {OP_COPY, 0, len, base_offset, 0};
+        return true;
+    }
+
+    bool flushCopy() {
+        if (pending_copy.len == 0) {
+            return true;
+        }
+        copied += pending_copy.len;
+        bool ok = writeOp(pending_copy, nullptr);
+        pending_copy.len = 0;
+        return ok;
+    }
+
+    bool emit(OpKind kind, uint64_t base_offset, size_t len) {
+        if (!flushCopy()) {
+            return false;
+        }
+        size_t n = compression_encode_buffer(packed.data(), len - 1, target.data(), len, nullptr, COMPRESSION_LZ4_RAW);
+        Op op = {kind, 0, len, base_offset, n > 0 ? n : len};
+        return writeOp(op, n > 0 ? packed.data() : target.data());
+    }
+
+    bool writeOp(const Op& op, const uint8_t* payload) {
+        if (!pwriteAll(delta_fd, &op, sizeof(op), pos)) {
+            return false;
+        }
+        pos += sizeof(op);
+        if (op.kind != OP_COPY) {
+            if (!pwriteAll(delta_fd, payload, op.packed_len, pos)) {
+                return false;
+            }
+            pos += (off_t)op.packed_len;
+        }
+        n_ops++;
+        return true;
+    }
+
+    int base_fd;
+    int target_fd;
+    int delta_fd;
+    std::vector<uint8_t> target;
+    std::vector<uint8_t> base;
+    std::vector<uint8_t> packed;
+    Op pending_copy = {OP_COPY, 0, 0, 0, 0};
+};
+
+}  // namespace
+
+namespace GgufDelta {
+
+bool create(const char* base_path, const char* target_path, const char* delta_path) {
+    std::vector<std::pair<std::string, TensorRange>> base_tensors;
+    std::vector<std::pair<std::string, TensorRange>> target_tensors;
+    if (!readTensors(base_path, base_tensors) || !readTensors(target_path, target_tensors)) {
+        LOGe("Failed to read tensors from %s or %s", base_path, target_path);
+        return false;
+    }
+    std::map<std::string, TensorRange> base_by_name(base_tensors.begin(), base_tensors.end());
+    std::sort(target_tensors.begin(), target_tensors.end(),
+              [](const auto& a, const auto& b) { return a.second.offset < b.second.offset; });
+
+    int base_fd = open(base_path, O_RDONLY);
+    int target_fd = open(target_path, O_RDONLY);
+    int delta_fd = open(delta_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    struct stat target_st;
+    Header header;
+    memcpy(header.magic, kMagic, 4);
+    header.version = kVersion;
+    bool ok = base_fd >= 0 && target_fd >= 0 && delta_fd >= 0 && fstat(target_fd, &target_st) == 0 &&
+              hashFile(base_fd, header.base_hash) && hashFile(target_fd, header.target_hash);
+
+    DeltaWriter writer(base_fd, target_fd, delta_fd);
+    uint64_t pos = 0;
+    for (size_t i = 0; ok && i < target_tensors.size(); i++) {
+        const std::string& name = target_tensors[i].first;
+        const TensorRange& range = target_tensors[i].second;
+        if (range.offset > pos) {
+            ok = writer.data(pos, range.offset - pos);
+        }
+        auto it = base_by_name.find(name);
+        if (!ok) {
+            break;
+        } else if (it != base_by_name.end() && it->second.size == range.size) {
+            ok = writer.tensor(range.offset, it->second.offset, range.size);
+        } else {
+            ok = writer.data(range.offset, range.size);
+        }
+        pos = range.offset + range.size;
+    }
+    if (ok) {
+        header.target_size = (uint64_t)target_st.st_size;
+        ok = (pos >= header.target_size || writer.data(pos, header.target_size - pos)) && writer.finish();
+        header.n_ops = writer.n_ops;
+        ok = ok && pwriteAll(delta_fd, &header, sizeof(header), 0);
+    }
+
+    for (int fd : {base_fd, target_fd, delta_fd}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (!ok) {
+        LOGe("Failed to create delta from %s to %s", base_path, target_path);
+        unlink(delta_path);
+        return false;
+    }
+    LOGi("Created delta %s: %llu MB for a %llu MB target, %llu MB copied from base", delta_path,
+         (unsigned long long)(writer.pos >> 20), (unsigned long long)(header.target_size >> 20),
+         (unsigned long long)(writer.copied >> 20));
+    return true;
+}
+
+bool apply(const char* base_path, const char* delta_path, const char* out_path) {
+    int base_fd = open(base_path, O_RDONLY);
+    int delta_fd = open(delta_path, O_RDONLY);
+    std::string tmp_path = std::string(out_path) + ".tmp";
+    int out_fd = -1;
+
+    Header header;
+    uint8_t digest[CC_SHA256_DIGEST_LENGTH];
+    bool ok = base_fd >= 0 && delta_fd >= 0 && preadAll(delta_fd, &header, sizeof(header), 0) &&
+              memcmp(header.magic, kMagic, 4) == 0 && header.version == kVersion;
+    if (ok && (!hashFile(base_fd, digest) || memcmp(digest, header.base_hash, sizeof(digest)) != 0)) {
+        LOGe("Delta %s does not apply to %s", delta_path, base_path);
+        ok = false;
+    }
+    if (ok) {
+        out_fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ok = out_fd >= 0;
+    }
+
+    CC_SHA256_CTX sha;
+    CC_SHA256_Init(&sha);
+    std::vector<uint8_t> out(kPiece);
+    std::vector<uint8_t> base(kPiece);
+    std::vector<uint8_t> packed(kPiece);
+    off_t delta_pos = sizeof(Header);
+    uint64_t written = 0;
+    for (uint64_t i = 0; ok && i < header.n_ops; i++) {
+        Op op;
+        ok = preadAll(delta_fd, &op, sizeof(op), delta_pos) && written + op.len <= header.target_size;
+        delta_pos += sizeof(op);
+        if (!ok) {
+            break;
+        }
+        if (op.kind == OP_COPY) {
+            for (uint64_t done = 0; ok && done < op.len; done += kPiece) {
+                size_t n = std::min<uint64_t>(kPiece, op.len - done);
+                ok = preadAll(base_fd, out.data(), n, (off_t)(op.base_offset + done)) &&
+                     pwriteAll(out_fd, out.data(), n, (off_t)(written + done));
+                CC_SHA256_Update(&sha, out.data(), (CC_LONG)n);
+            }
+        } else {
+            ok = (op.kind == OP_DATA || op.kind == OP_XOR) && op.len <= kPiece && op.packed_len <= op.len;
+            if (ok && op.packed_len == op.len) {
+                ok = preadAll(delta_fd, out.data(), op.len, delta_pos);
+            } else if (ok) {
+                ok = preadAll(delta_fd, packed.data(), op.packed_len, delta_pos) &&
+                     compression_decode_buffer(out.data(), op.len, packed.data(), op.packed_len, nullptr,
+                                               COMPRESSION_LZ4_RAW) == op.len;
+            }
+            delta_pos += (off_t)op.packed_len;
+            if (ok && op.kind == OP_XOR) {
+                ok = preadAll(base_fd, base.data(), op.len, (off_t)op.base_offset);
+                for (size_t j = 0; ok && j < op.len; j++) {
+                    out[j] ^= base[j];
+                }
+            }
+            ok = ok && pwriteAll(out_fd, out.data(), op.len, (off_t)written);
+            CC_SHA256_Update(&sha, out.data(), (CC_LONG)op.len);
+        }
+        written += op.len;
+    }
+    CC_SHA256_Final(digest, &sha);
+    if (ok && (written != header.target_size || memcmp(digest, header.target_hash, sizeof(digest)) != 0)) {
+        LOGe("Delta %s produced a file that does not match its target hash", delta_path);
+        ok = false;
+    }
+    ok = ok && fsync(out_fd) == 0;
+
+    for (int fd : {base_fd, delta_fd, out_fd}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (!ok || rename(tmp_path.c_str(), out_path) != 0) {
+        LOGe("Failed to apply delta %s to %s", delta_path, base_path);
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    LOGi("Applied delta %s to %s", delta_path, base_path);
+    return true;
+}
+
+}  // namespace GgufDelta
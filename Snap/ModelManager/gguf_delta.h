@@ -0,0 +1,18 @@
+#pragma once
+
+// Binary model updates. A delta rebuilds a target GGUF from a base GGUF
+// tensor by tensor: unchanged tensors are copied from the base, tensors of
+// the same size are stored as an LZ4-compressed XOR against the base (a
+// fine-tune leaves most bytes equal), and everything else, including the
+// metadata header, is stored as LZ4-compressed data. Both files are pinned
+// by SHA-256.
+namespace GgufDelta {
+
+// Offline: writes the delta that turns base_path into target_path
+bool create(const char* base_path, const char* target_path, const char* delta_path);
+
+// Rebuilds the target into a temporary file next to out_path, verifies its
+// hash and renames it over out_path. out_path may be base_path.
+bool apply(const char* base_path, const char* delta_path, const char* out_path);
+
+}  // namespace GgufDelta
@@ -0,0 +1,50 @@
+#include "image_embedding_cache.h"
+#include <cstdio>
+#include <cstring>
+
+std::string ImageEmbeddingCache::makeId(const uint8_t* data, size_t size) {
+    // 64-bit multiply-xor over whole words, bytes for the tail
+    uint64_t h = 0xcbf29ce484222325ULL ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, sizeof(w));
+        h = (h ^ w) * 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    for (; i < size; i++) {
+        h = (h ^ data[i]) * 0x100000001b3ULL;
+    }
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+    return buf;
+}
+
+const std::vector<float>* ImageEmbeddingCache::find(const std::string& id) {
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it->first == id) {
+            entries.splice(entries.begin(), entries, it);
+            return &entries.front().second;
+        }
+    }
+    return nullptr;
+}
+
+void ImageEmbeddingCache::put(const std::string& id, std::vector<float>&& embd) {
+    if (find(id)) {
+        entries.front().second = std::move(embd);
+        return;
+    }
+    entries.emplace_front(id, std::move(embd));
+    while (entries.size() > capacity) {
+        spare = std::move(entries.back().second);
+        entries.pop_back();
+    }
+}
+
+std::vector<float> ImageEmbeddingCache::buffer(size_t n) {
+    std::vector<float> buf = std::move(spare);
+    spare = std::vector<float>();
+    buf.resize(n);
+    return buf;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Projector output of recently ingested images, keyed by a hash of their
+// preprocessed pixels. An image encoded at ingest time, or asked about again
+// in a later turn, is decoded into the LM without running the encoder again.
+class ImageEmbeddingCache {
+public:
+    explicit ImageEmbeddingCache(size_t capacity = 4) : capacity(capacity) {}
+
+    // Content id for a bitmap, used as its mtmd bitmap id
+    static std::string makeId(const uint8_t* data, size_t size);
+
+    // Returned pointer stays valid until the entry is evicted
+    const std::vector<float>* find(const std::string& id);
+    void put(const std::string& id, std::vector<float>&& embd);
+    void clear() { entries.clear(); spare.clear(); }
+
+    // Buffer of n floats for the next put, reusing the storage of the last
+    // evicted entry; encodes of one resolution then stop allocating
+    std::vector<float> buffer(size_t n);
+
+    // Never shrinks; an image split into tiles needs an entry per tile
+    void ensureCapacity(size_t n) { capacity = std::max(capacity, n); }
+
+private:
+    size_t capacity;
+    std::list<std::pair<std::string, std::vector<float>>> entries;  // most recent first
+    std::vector<float> spare;
+};
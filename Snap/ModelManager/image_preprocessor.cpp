@@ -0,0 +1,165 @@
+#include "image_preprocessor.h"
+#include "model_manager.h"
+#include "gguf.h"
+#include <algorithm>
+#include <vector>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Adds one source row into planar R, G, B accumulators
+void accumulateRow(const uint8_t* row, int width, int channels, uint32_t* acc_r, uint32_t* acc_g, uint32_t* acc_b) {
+    int x = 0;
+#if defined(__ARM_NEON)
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t r, g, b;
+        if (channels == 4) {
+            uint8x16x4_t px = vld4q_u8(row + x * 4);
+            r = px.val[0]; g = px.val[1]; b = px.val[2];
+        } else {
+            uint8x16x3_t px = vld3q_u8(row + x * 3);
+            r = px.val[0]; g = px.val[1]; b = px.val[2];
+        }
+        uint32_t* accs[3] = {acc_r + x, acc_g + x, acc_b + x};
+        uint8x16_t vals[3] = {r, g, b};
+        for (int c = 0; c < 3; c++) {
+            uint16x8_t lo = vmovl_u8(vget_low_u8(vals[c]));
+            uint16x8_t hi = vmovl_u8(vget_high_u8(vals[c]));
+            uint32_t* a = accs[c];
+            vst1q_u32(a,      vaddw_u16(vld1q_u32(a),      vget_low_u16(lo)));
+            vst1q_u32(a + 4,  vaddw_u16(vld1q_u32(a + 4),  vget_high_u16(lo)));
+            vst1q_u32(a + 8,  vaddw_u16(vld1q_u32(a + 8),  vget_low_u16(hi)));
+            vst1q_u32(a + 12, vaddw_u16(vld1q_u32(a + 12), vget_high_u16(hi)));
+        }
+    }
+#endif
+    for (; x < width; x++) {
+        const uint8_t* px = row + x * channels;
+        acc_r[x] += px[0];
+        acc_g[x] += px[1];
+        acc_b[x] += px[2];
+    }
+}
+
+} // namespace
+
+bool ImagePreprocessor::load(const char* mmproj_path) {
+    reset();
+    gguf_init_params params = {true, nullptr};
+    gguf_context* ctx = gguf_init_from_file(mmproj_path, params);
+    if (!ctx) {
+        LOGe("Failed to read preprocessing parameters from %s", mmproj_path);
+        return false;
+    }
+    int64_t key = gguf_find_key(ctx, "clip.vision.image_size");
+    if (key >= 0) {
+        image_size = (int)gguf_get_val_u32(ctx, key);
+    }
+    key = gguf_find_key(ctx, "clip.vision.preproc_image_size");
+    if (key >= 0) {
+        preproc_image_size = (int)gguf_get_val_u32(ctx, key);
+    }
+    int patch_size = 0;
+    int scale_factor = 1;
+    key = gguf_find_key(ctx, "clip.vision.patch_size");
+    if (key >= 0) {
+        patch_size = (int)gguf_get_val_u32(ctx, key);
+    }
+    key = gguf_find_key(ctx, "clip.vision.projector.scale_factor");
+    if (key >= 0) {
+        scale_factor = std::max(1, (int)gguf_get_val_u32(ctx, key));
+    }
+    if (patch_size > 0) {
+        int side = image_size / patch_size / scale_factor;
+        tile_tokens = side * side;
+    }
+    gguf_free(ctx);
+    LOGi("Image preprocessing: tile %d, longest edge %d, %d tokens per tile", image_size, preproc_image_size,
+         tile_tokens);
+    return true;
+}
+
+void ImagePreprocessor::targetSize(int width, int height, int& out_width, int& out_height, int edge_cap) const {
+    int longest = preproc_image_size;
+    for (int cap : {max_edge, edge_cap}) {
+        if (cap > 0 && (longest <= 0 || cap < longest)) {
+            longest = cap;
+        }
+    }
+    if (longest <= 0) {
+        out_width = width;
+        out_height = height;
+        return;
+    }
+    // Scale down to fit the longest edge, then round each side up to whole tiles
+    float scale = std::min(1.0f, std::min((float)longest / width, (float)longest / height));
+    if (image_size <= 0 || preproc_image_size <= 0) {
+        out_width = std::max(1, (int)(width * scale));
+        out_height = std::max(1, (int)(height * scale));
+        return;
+    }
+    auto align = [this](float v) { return (((int)v + image_size - 1) / image_size) * image_size; };
+    out_width = align(width * scale);
+    out_height = align(height * scale);
+}
+
+mtmd::bitmap ImagePreprocessor::toBitmap(const uint8_t* pixels, int width, int height, int stride, int channels,
+                                         int edge_cap) const {
+    if (!pixels || width <= 0 || height <= 0 || (channels != 3 && channels != 4) || stride < width * channels) {
+        LOGe("Invalid pixel buffer %dx%d, %d channels, stride %d", width, height, channels, stride);
+        return mtmd::bitmap();
+    }
+
+    int out_w, out_h;
+    targetSize(width, height, out_w, out_h, edge_cap);
+
+    // Source footprint of each output column; upscaled axes get a single pixel
+    std::vector<int> x0(out_w + 1);
+    for (int ox = 0; ox <= out_w; ox++) {
+        x0[ox] = (int)((int64_t)ox * width / out_w);
+    }
+
+    std::vector<uint32_t> acc((size_t)width * 3);
+    std::vector<uint32_t> prefix((size_t)(width + 1) * 3);
+    std::vector<uint8_t> rgb((size_t)out_w * out_h * 3);
+    uint32_t* acc_r = acc.data();
+    uint32_t* acc_g = acc_r + width;
+    uint32_t* acc_b = acc_g + width;
+
+    for (int oy = 0; oy < out_h; oy++) {
+        int y_begin = (int)((int64_t)oy * height / out_h);
+        int y_end = std::max(y_begin + 1, (int)((int64_t)(oy + 1) * height / out_h));
+
+        std::fill(acc.begin(), acc.end(), 0);
+        for (int y = y_begin; y < y_end; y++) {
+            accumulateRow(pixels + (size_t)y * stride, width, channels, acc_r, acc_g, acc_b);
+        }
+
+        // Prefix sums turn each output pixel's horizontal box into one subtraction
+        const uint32_t* planes[3] = {acc_r, acc_g, acc_b};
+        for (int c = 0; c < 3; c++) {
+            uint32_t* p = prefix.data() + (size_t)c * (width + 1);
+            p[0] = 0;
+            for (int x = 0; x < width; x++) {
+                p[x + 1] = p[x] + planes[c][x];
+            }
+        }
+
+        uint8_t* out = rgb.data() + (size_t)oy * out_w * 3;
+        uint32_t rows = (uint32_t)(y_end - y_begin);
+        for (int ox = 0; ox < out_w; ox++) {
+            int xb = x0[ox];
+            int xe = std::max(xb + 1, x0[ox + 1]);
+            uint32_t count = rows * (uint32_t)(xe - xb);
+            for (int c = 0; c < 3; c++) {
+                const uint32_t* p = prefix.data() + (size_t)c * (width + 1);
+                out[ox * 3 + c] = (uint8_t)((p[xe] - p[xb] + count / 2) / count);
+            }
+        }
+    }
+
+    return mtmd::bitmap(out_w, out_h, rgb.data());
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include "mtmd.h"
+
+// Fused ingest stage for camera and decoded pixels. Converts RGBA or RGB
+// source pixels straight to an RGB bitmap at the resolution the mmproj
+// preprocessor would resize to, area-averaging in a single vectorized pass
+// over the source. mtmd's own resize then runs at identity size instead of
+// over the full-resolution frame.
+class ImagePreprocessor {
+public:
+    // Reads the preprocessing parameters from the mmproj GGUF metadata
+    bool load(const char* mmproj_path);
+    void reset() { image_size = 0; preproc_image_size = 0; tile_tokens = 0; }
+
+    // Caps the longest edge below the projector's own, trading detail for
+    // fewer tiles; zero removes the cap. Kept across load and reset.
+    void setMaxEdge(int px) { max_edge = px; }
+
+    // Returns an empty bitmap (null ptr) on failure. A nonzero edge_cap
+    // lowers the longest edge for this image only.
+    mtmd::bitmap toBitmap(const uint8_t* pixels, int width, int height, int stride, int channels,
+                          int edge_cap = 0) const;
+
+    // Target size for a source image, same rule as the projector's tiling
+    void targetSize(int width, int height, int& out_width, int& out_height, int edge_cap = 0) const;
+
+    // Tile edge, zero when the projector doesn't tile, and the LM tokens
+    // each tile becomes, zero when the metadata doesn't say
+    int tileSize() const { return preproc_image_size > 0 ? image_size : 0; }
+    int tileTokens() const { return tile_tokens; }
+
+private:
+    // Tile edge and the longest edge the projector resizes to before tiling;
+    // zero when the projector doesn't resize up front
+    int image_size = 0;
+    int preproc_image_size = 0;
+    int tile_tokens = 0;
+    int max_edge = 0;
+};
@@ -0,0 +1,141 @@
+#include "maintenance_scheduler.h"
+#include "model_manager.h"
+#include <algorithm>
+#include <chrono>
+
+#if defined(__APPLE__)
+#include <pthread/qos.h>
+#endif
+
+namespace {
+
+int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+void MaintenanceScheduler::start() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (worker.joinable()) {
+        return;
+    }
+    stopping = false;
+    last_request_end_ms = nowMs();
+    worker = std::thread(&MaintenanceScheduler::run, this);
+}
+
+void MaintenanceScheduler::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void MaintenanceScheduler::addTask(const char* name, int64_t interval_ms, Task task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry entry;
+        entry.name = name;
+        entry.interval_ms = interval_ms;
+        entry.task = std::move(task);
+        entry.next_due_ms = nowMs() + interval_ms;
+        tasks.push_back(std::move(entry));
+    }
+    cv.notify_all();
+}
+
+void MaintenanceScheduler::clearTasks() {
+    // Wait out a step in flight so its task isn't destroyed under it
+    std::lock_guard<std::mutex> step_lock(step_mutex);
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.clear();
+}
+
+void MaintenanceScheduler::beginRequest() {
+    active_requests++;
+    // Waits for at most the one step already running
+    std::lock_guard<std::mutex> step_lock(step_mutex);
+}
+
+void MaintenanceScheduler::endRequest() {
+    {
+        // Decremented under the lock so the worker can't miss the wakeup
+        std::lock_guard<std::mutex> lock(mutex);
+        last_request_end_ms = nowMs();
+        active_requests--;
+    }
+    cv.notify_all();
+}
+
+MaintenanceScheduler::Entry* MaintenanceScheduler::nextDueTask(int64_t now_ms) {
+    Entry* next = nullptr;
+    for (auto& entry : tasks) {
+        if ((entry.running || entry.next_due_ms <= now_ms) && (!next || entry.next_due_ms < next->next_due_ms)) {
+            next = &entry;
+        }
+    }
+    return next;
+}
+
+void MaintenanceScheduler::run() {
+#if defined(__APPLE__)
+    pthread_set_qos_class_self_np(QOS_CLASS_BACKGROUND, 0);
+#endif
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        if (!isIdle()) {
+            cv.wait(lock);  // endRequest notifies
+            continue;
+        }
+        int64_t now_ms = nowMs();
+        int64_t idle_at_ms = last_request_end_ms + idle_delay_ms;
+        if (now_ms < idle_at_ms) {
+            cv.wait_for(lock, std::chrono::milliseconds(idle_at_ms - now_ms));
+            continue;
+        }
+        Entry* entry = nextDueTask(now_ms);
+        if (!entry) {
+            int64_t wake_ms = now_ms + 60000;
+            for (const auto& e : tasks) {
+                wake_ms = std::min(wake_ms, e.next_due_ms);
+            }
+            cv.wait_for(lock, std::chrono::milliseconds(std::max<int64_t>(wake_ms - now_ms, 1)));
+            continue;
+        }
+
+        std::string name = entry->name;
+        Task task = entry->task;
+        lock.unlock();
+
+        bool more = false;
+        bool ran = false;
+        {
+            std::lock_guard<std::mutex> step_lock(step_mutex);
+            // A request may have started between picking the task and getting here
+            if (isIdle()) {
+                more = task();
+                ran = true;
+            }
+        }
+
+        lock.lock();
+        if (!ran) {
+            continue;
+        }
+        for (auto& e : tasks) {
+            if (e.name == name) {
+                e.running = more;
+                if (!more) {
+                    e.next_due_ms = nowMs() + e.interval_ms;
+                }
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Low-priority background worker that runs maintenance while the core is
+// idle. Tasks are split into short steps; a step only starts when no
+// foreground request is active, and a request arriving mid-step waits for
+// at most that one step before it proceeds.
+class MaintenanceScheduler {
+public:
+    // One short step of work; returns true while the task has more to do
+    using Task = std::function<bool()>;
+
+    MaintenanceScheduler() = default;
+    MaintenanceScheduler(const MaintenanceScheduler&) = delete;
+    MaintenanceScheduler& operator=(const MaintenanceScheduler&) = delete;
+    ~MaintenanceScheduler() { stop(); }
+
+    void start();
+    void stop();
+
+    // Tasks become due every interval_ms, and stay due until they report done
+    void addTask(const char* name, int64_t interval_ms, Task task);
+    void clearTasks();
+
+    // Foreground work is bracketed by these; maintenance never overlaps it
+    void beginRequest();
+    void endRequest();
+    bool isIdle() const { return active_requests.load() == 0; }
+
+    // How long the core has to be idle before maintenance starts
+    void setIdleDelay(int64_t ms) { idle_delay_ms = ms; }
+
+private:
+    struct Entry {
+        std::string name;
+        int64_t interval_ms;
+        Task task;
+        int64_t next_due_ms = 0;
+        bool running = false;  // a previous run reported more work
+    };
+
+    void run();
+    Entry* nextDueTask(int64_t now_ms);
+
+    std::mutex mutex;           // guards tasks, last_request_end_ms, stopping
+    std::mutex step_mutex;      // held while a step runs
+    std::condition_variable cv;
+    std::vector<Entry> tasks;
+    std::atomic<int> active_requests{0};
+    int64_t last_request_end_ms = 0;
+    int64_t idle_delay_ms = 500;
+    bool stopping = false;
+    std::thread worker;
+};
+
+// Marks a foreground request for the lifetime of the scope
+class MaintenanceRequestScope {
+public:
+    explicit MaintenanceRequestScope(MaintenanceScheduler& scheduler) : scheduler(scheduler) { scheduler.beginRequest(); }
+    ~MaintenanceRequestScope() { scheduler.endRequest(); }
+    MaintenanceRequestScope(const MaintenanceRequestScope&) = delete;
+    MaintenanceRequestScope& operator=(const MaintenanceRequestScope&) = delete;
+
+private:
+    MaintenanceScheduler& scheduler;
+};
@@ -0,0 +1,217 @@
+#include "model_archive.h"
+#include "file_io.h"
+#include "model_manager.h"
+#include <algorithm>
+#include <atomic>
+#include <compression.h>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const char kMagic[4] = {'S', 'N', 'P', 'Z'};
+const uint32_t kVersion = 1;
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t raw_size;
+    uint32_t block_size;
+    uint32_t n_blocks;
+};
+
+bool readHeader(int fd, Header& header, std::vector<uint64_t>& offsets) {
+    if (!preadAll(fd, &header, sizeof(header), 0) || memcmp(header.magic, kMagic, 4) != 0 ||
+        header.version != kVersion || header.block_size == 0) {
+        return false;
+    }
+    uint64_t expected = (header.raw_size + header.block_size - 1) / header.block_size;
+    if (header.n_blocks != expected) {
+        return false;
+    }
+    offsets.resize(header.n_blocks + 1);
+    if (!preadAll(fd, offsets.data(), offsets.size() * sizeof(uint64_t), sizeof(header))) {
+        return false;
+    }
+    for (uint32_t i = 0; i < header.n_blocks; i++) {
+        if (offsets[i + 1] < offsets[i] || offsets[i + 1] - offsets[i] > header.block_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+namespace ModelArchive {
+
+bool isArchive(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    char magic[4];
+    bool result = preadAll(fd, magic, sizeof(magic), 0) && memcmp(magic, kMagic, 4) == 0;
+    close(fd);
+    return result;
+}
+
+bool pack(const char* src_path, const char* dst_path, uint32_t block_size) {
+    int in = open(src_path, O_RDONLY);
+    if (in < 0) {
+        LOGe("Failed to open %s", src_path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(in, &st) != 0 || block_size == 0) {
+        close(in);
+        return false;
+    }
+    int out = open(dst_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        LOGe("Failed to create %s", dst_path);
+        close(in);
+        return false;
+    }
+
+    Header header;
+    memcpy(header.magic, kMagic, 4);
+    header.version = kVersion;
+    header.raw_size = (uint64_t)st.st_size;
+    header.block_size = block_size;
+    header.n_blocks = (uint32_t)((header.raw_size + block_size - 1) / block_size);
+
+    std::vector<uint64_t> offsets(header.n_blocks + 1);
+    std::vector<uint8_t> raw(block_size);
+    std::vector<uint8_t> packed(block_size);
+    uint64_t pos = sizeof(header) + offsets.size() * sizeof(uint64_t);
+    bool ok = true;
+    for (uint32_t i = 0; i < header.n_blocks && ok; i++) {
+        size_t len = std::min<uint64_t>(block_size, header.raw_size - (uint64_t)i * block_size);
+        ok = preadAll(in, raw.data(), len, (off_t)i * block_size);
+        if (!ok) {
+            break;
+        }
+        // A result that fills the buffer didn't shrink the block; store it raw
+        size_t n = compression_encode_buffer(packed.data(), len - 1, raw.data(), len, nullptr, COMPRESSION_LZ4_RAW);
+        const uint8_t* data = n > 0 ? packed.data() : raw.data();
+        size_t data_len = n > 0 ? n : len;
+        offsets[i] = pos;
+        ok = pwriteAll(out, data, data_len, (off_t)pos);
+        pos += data_len;
+    }
+    offsets[header.n_blocks] = pos;
+    ok = ok && pwriteAll(out, &header, sizeof(header), 0) &&
+         pwriteAll(out, offsets.data(), offsets.size() * sizeof(uint64_t), sizeof(header));
+    close(in);
+    close(out);
+    if (!ok) {
+        LOGe("Failed to pack %s", src_path);
+        unlink(dst_path);
+        return false;
+    }
+    LOGi("Packed %s: %llu MB -> %llu MB", src_path, (unsigned long long)(header.raw_size >> 20),
+         (unsigned long long)(pos >> 20));
+    return true;
+}
+
+bool unpack(const char* src_path, const char* dst_path, int n_threads) {
+    int in = open(src_path, O_RDONLY);
+    if (in < 0) {
+        LOGe("Failed to open %s", src_path);
+        return false;
+    }
+    Header header;
+    std::vector<uint64_t> offsets;
+    struct stat src_st;
+    if (fstat(in, &src_st) != 0 || !readHeader(in, header, offsets) ||
+        offsets[header.n_blocks] != (uint64_t)src_st.st_size) {
+        LOGe("Invalid model archive %s", src_path);
+        close(in);
+        return false;
+    }
+
+    struct stat dst_st;
+    if (stat(dst_path, &dst_st) == 0 && (uint64_t)dst_st.st_size == header.raw_size &&
+        dst_st.st_mtime >= src_st.st_mtime) {
+        close(in);
+        return true;
+    }
+
+    std::string tmp_path = std::string(dst_path) + ".tmp";
+    int out = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out < 0 || ftruncate(out, (off_t)header.raw_size) != 0) {
+        LOGe("Failed to create %s", tmp_path.c_str());
+        if (out >= 0) {
+            close(out);
+        }
+        close(in);
+        return false;
+    }
+
+    int64_t t_start_us = ggml_time_us();
+    std::atomic<uint32_t> next_block{0};
+    std::atomic<bool> failed{false};
+    std::atomic<int64_t> read_us{0};  // summed over the workers
+    auto worker = [&]() {
+        std::vector<uint8_t> packed(header.block_size);
+        std::vector<uint8_t> raw(header.block_size);
+        for (uint32_t i = next_block++; i < header.n_blocks && !failed; i = next_block++) {
+            size_t len = std::min<uint64_t>(header.block_size, header.raw_size - (uint64_t)i * header.block_size);
+            size_t packed_len = offsets[i + 1] - offsets[i];
+            int64_t t_read_us = ggml_time_us();
+            if (!preadAll(in, packed.data(), packed_len, (off_t)offsets[i])) {
+                failed = true;
+                break;
+            }
+            read_us += ggml_time_us() - t_read_us;
+            const uint8_t* data = packed.data();
+            if (packed_len != len) {
+                size_t n = compression_decode_buffer(raw.data(), len, packed.data(), packed_len, nullptr,
+                                                     COMPRESSION_LZ4_RAW);
+                if (n != len) {
+                    failed = true;
+                    break;
+                }
+                data = raw.data();
+            }
+            if (!pwriteAll(out, data, len, (off_t)i * header.block_size)) {
+                failed = true;
+                break;
+            }
+        }
+    };
+    n_threads = std::max(n_threads, 1);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n_threads; i++) {
+        threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    close(in);
+    close(out);
+
+    if (failed || rename(tmp_path.c_str(), dst_path) != 0) {
+        LOGe("Failed to unpack %s", src_path);
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    // Storage throughput of the same parallel reads, which bounds a plain GGUF load
+    double seconds = (ggml_time_us() - t_start_us) / 1e6;
+    double read_seconds = read_us.load() / 1e6 / n_threads;
+    double raw_mb = header.raw_size / 1048576.0;
+    double packed_mb = src_st.st_size / 1048576.0;
+    double read_mbps = read_seconds > 0 ? packed_mb / read_seconds : 0.0;
+    LOGi("Unpacked %s: %.0f MB from %.0f MB in %.2f s (%.0f MB/s out); storage reads at %.0f MB/s, so the "
+         "plain GGUF would take %.2f s to read", src_path, raw_mb, packed_mb, seconds,
+         seconds > 0 ? raw_mb / seconds : 0.0, read_mbps, read_mbps > 0 ? raw_mb / read_mbps : 0.0);
+    return true;
+}
+
+}  // namespace ModelArchive
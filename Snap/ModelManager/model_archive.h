@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Seekable compressed model container. The GGUF is cut into fixed-size
+// blocks, each LZ4-compressed on its own, with an offset table up front so
+// blocks can be decoded in parallel:
+//
+//   "SNPZ" u32 version, u64 raw_size, u32 block_size, u32 n_blocks
+//   u64 offsets[n_blocks + 1]   absolute file offsets of the blocks
+//   block data                  stored raw when LZ4 doesn't shrink it
+namespace ModelArchive {
+
+bool isArchive(const char* path);
+
+// Offline packing of a plain GGUF
+bool pack(const char* src_path, const char* dst_path, uint32_t block_size = 1u << 20);
+
+// Decodes into dst_path via a temporary file next to it and rename. An
+// existing dst_path of the right size that is newer than the archive is
+// kept. dst_path may be src_path, replacing the archive with its GGUF.
+// Logs the decode throughput against the storage read throughput measured
+// on the archive's own reads, i.e. what a plain GGUF read would cost.
+bool unpack(const char* src_path, const char* dst_path, int n_threads = 4);
+
+}  // namespace ModelArchive
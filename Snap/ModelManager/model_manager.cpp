@@ -1,12 +1,248 @@
 #include "model_manager.h"
+#include "model_archive.h"
 #include <iostream>
 #include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#if defined(__APPLE__)
+#include <pthread/qos.h>
+#endif
+
+namespace {
+
+thread_local bool speculating = false;  // the calling thread is the speculation worker
+
+// Tiles that flat are dropped even when the budget would allow them
+constexpr float kMinTileScore = 0.08f;
+
+// Selective tiling queues an image as several parts ("<image id>/<tile>" ...
+// "<image id>/global"); returns the number of queued bitmaps of each image
+std::vector<size_t> imageGroups(mtmd::bitmaps& bitmaps) {
+    std::vector<size_t> group_sizes;
+    bool open = false;
+    for (mtmd::bitmap& bmp : bitmaps.entries) {
+        std::string id = bmp.id();
+        bool part = id.find('/') != std::string::npos;
+        if (part && open) {
+            group_sizes.back()++;
+        } else {
+            group_sizes.push_back(1);
+        }
+        open = part && !(id.size() >= 7 && id.compare(id.size() - 7, 7, "/global") == 0);
+    }
+    return group_sizes;
+}
+
+// Short stand-in for an evicted image: the first sentence of the reply to
+// the message it came with
+std::string imageSummary(const std::vector<common_chat_msg>& history, size_t msg_index) {
+    if (msg_index + 1 >= history.size() || history[msg_index + 1].role != "assistant") {
+        return std::string();
+    }
+    const std::string& reply = history[msg_index + 1].content;
+    size_t begin = reply.find_first_not_of(" \n");
+    if (begin == std::string::npos) {
+        return std::string();
+    }
+    size_t end = std::min(reply.find_first_of(".!?\n", begin), begin + 160);
+    if (end < reply.size() && reply[end] != '\n') {
+        end++;
+    }
+    return " (Earlier image: " + reply.substr(begin, end - begin) + ") ";
+}
+
+// Each image's marker becomes one marker per part
+std::string expandImageMarkers(const std::string& text, mtmd::bitmaps& bitmaps) {
+    const std::string marker = "<__image__>";
+    std::vector<size_t> group_sizes = imageGroups(bitmaps);
+    if (group_sizes.size() == bitmaps.entries.size()) {
+        return text;
+    }
+
+    // On a marker count mismatch the text is left for mtmd to reject
+    std::string out;
+    size_t pos = 0;
+    size_t n_markers = 0;
+    for (size_t found; (found = text.find(marker, pos)) != std::string::npos; pos = found + marker.size()) {
+        if (n_markers == group_sizes.size()) {
+            return text;
+        }
+        out.append(text, pos, found - pos);
+        for (size_t i = 0; i < group_sizes[n_markers]; i++) {
+            out += marker;
+        }
+        n_markers++;
+    }
+    out.append(text, pos, std::string::npos);
+    return n_markers == group_sizes.size() ? out : text;
+}
+
+// Crops the given tiles of an image in reading order. Each crop goes to mtmd as
+// an image of its own, so it is wrapped like a whole image: a projector that
+// marks the tiles of its own split (idefics3's <row_r_col_c> tokens) doesn't
+// see those markers, and a tile's place is only implied by the order.
+void cropTiles(mtmd::bitmap& bmp, const std::string& id, std::vector<SaliencyTiles::Tile> tiles, int tile_size,
+               std::vector<mtmd::bitmap>& parts) {
+    std::sort(tiles.begin(), tiles.end(), [](const SaliencyTiles::Tile& a, const SaliencyTiles::Tile& b) {
+        return a.row != b.row ? a.row < b.row : a.col < b.col;
+    });
+    for (const SaliencyTiles::Tile& tile : tiles) {
+        parts.push_back(SaliencyTiles::crop(bmp.data(), bmp.nx(), tile.col * tile_size, tile.row * tile_size, tile_size));
+        std::string part_id = id + "/" + std::to_string(tile.row) + "_" + std::to_string(tile.col);
+        parts.back().set_id(part_id.c_str());
+    }
+}
+
+// Low resolution view of the whole image, always the last part of a split image
+mtmd::bitmap globalPart(mtmd::bitmap& bmp, const std::string& id, int tile_size) {
+    mtmd::bitmap global = SaliencyTiles::globalView(bmp.data(), bmp.nx(), bmp.ny(), tile_size);
+    global.set_id((id + "/global").c_str());
+    return global;
+}
+
+}  // namespace
+
+// Holds a session for one request. The maintenance scope comes first, so no
+// maintenance step runs between swapping the session in and the request's
+// own steps. A speculation on the session is stopped before the turn is
+// taken, since its worker holds the turn. Images the request leaves
+// unconsumed go back to the session's queue.
+class ModelManager::SessionTurn {
+public:
+    // With reply_prompt, a speculative reply to that prompt is adopted rather
+    // than rolled back. stop cancels the request, including its wait for a
+    // KV sequence.
+    SessionTurn(ModelManager& manager, int id, const char* reply_prompt = nullptr,
+                const std::atomic<bool>* stop = nullptr)
+        : manager(manager) {
+        s = manager.findSession(id);
+        if (!s) {
+            LOGe("Unknown session %d", id);
+            return;
+        }
+        if (s->owner.load() == std::this_thread::get_id()) {
+            resident = s->seq >= 0;
+            return;
+        }
+        outer = true;
+        manager.maintenance.beginRequest();
+        if (!speculating) {
+            manager.stopSpeculation(id);
+        }
+        s->mutex.lock();
+        s->owner = std::this_thread::get_id();
+        s->stop = stop;
+        resident = manager.makeResident(*s);
+        if (resident) {
+            if (!s->sampler && manager.sampler) {
+                s->sampler = common_sampler_clone(manager.sampler);
+            }
+            adopted = manager.settleSpeculation(*s, reply_prompt);
+            std::lock_guard<std::mutex> lock(manager.pending_mutex);
+            auto it = manager.pending_images.find(id);
+            if (it != manager.pending_images.end()) {
+                for (mtmd::bitmap& bmp : it->second.entries) {
+                    s->bitmaps.entries.push_back(std::move(bmp));
+                }
+                manager.pending_images.erase(it);
+            }
+        }
+    }
+
+    ~SessionTurn() {
+        if (!outer) {
+            return;
+        }
+        if (!s->bitmaps.entries.empty()) {
+            std::lock_guard<std::mutex> lock(manager.pending_mutex);
+            auto& queued = manager.pending_images[s->id].entries;
+            for (mtmd::bitmap& bmp : queued) {
+                s->bitmaps.entries.push_back(std::move(bmp));
+            }
+            queued = std::move(s->bitmaps.entries);
+            s->bitmaps.entries.clear();
+        }
+        s->stop = nullptr;
+        s->owner = std::thread::id();
+        s->mutex.unlock();
+        manager.maintenance.endRequest();
+    }
+
+    SessionTurn(const SessionTurn&) = delete;
+    SessionTurn& operator=(const SessionTurn&) = delete;
+
+    bool ok() const { return resident; }
+    bool adoptedSpeculation() const { return adopted; }
+    Session& session() { return *s; }
+
+private:
+    ModelManager& manager;
+    std::shared_ptr<Session> s;
+    bool outer = false;
+    bool resident = false;
+    bool adopted = false;
+};
+
+// Exclusive use of the model between steps, for KV cache edits and image
+// chunks. Nests on the holding thread; never held around runStep.
+class ModelManager::ModelLock {
+public:
+    explicit ModelLock(ModelManager& manager) : manager(manager) {
+        std::unique_lock<std::mutex> lock(manager.model_mutex);
+        if (manager.model_busy && manager.model_owner == std::this_thread::get_id()) {
+            manager.model_depth++;
+            return;
+        }
+        manager.model_cv.wait(lock, [&manager]() { return !manager.model_busy; });
+        manager.model_busy = true;
+        manager.model_owner = std::this_thread::get_id();
+        manager.model_depth = 1;
+        manager.setLowPower(false);
+    }
+
+    ~ModelLock() {
+        {
+            std::lock_guard<std::mutex> lock(manager.model_mutex);
+            if (--manager.model_depth > 0) {
+                return;
+            }
+            manager.model_busy = false;
+            manager.model_owner = std::thread::id();
+        }
+        manager.model_cv.notify_all();
+    }
+
+    ModelLock(const ModelLock&) = delete;
+    ModelLock& operator=(const ModelLock&) = delete;
+
+private:
+    ModelManager& manager;
+};
 
 ModelManager::~ModelManager() {
     cleanup();
 }
 
 void ModelManager::cleanup() {
+    readiness = 0;
+    stopSpeculation(-1);
+    maintenance.stop();
+    maintenance.clearTasks();
+    model_pages.close();
+    touching_weights = false;
+    waitForEncode();
+    mmproj_prefetch.wait();
+    {
+        std::lock_guard<std::mutex> lock(sessions_mutex);
+        sessions.clear();  // frees the session samplers
+        next_session_id = 1;
+    }
+    std::fill(std::begin(seq_owner), std::end(seq_owner), nullptr);
+    use_counter = 0;
+    session_store.clear();
     if (sampler) {
         common_sampler_free(sampler);
         sampler = nullptr;
@@ -15,6 +251,7 @@ void ModelManager::cleanup() {
         llama_free(lctx);
         lctx = nullptr;
     }
+    low_power = false;
     if (model) {
         llama_free_model(model);
         model = nullptr;
@@ -23,104 +260,886 @@ void ModelManager::cleanup() {
         mtmd_free(ctx_vision);
         ctx_vision = nullptr;
     }
+    mmproj_path.clear();
     vocab = nullptr;
-    n_past = 0;
-    bitmaps.entries.clear();
+    preprocessor.reset();
+    image_embeddings.clear();
+    prepared_images.clear();
+    length_predictor.clear();
+    n_encodes = 0;
+    encode_us = 0;
+    n_image_tokens = 0;
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    pending_images.clear();
 }
 
-bool ModelManager::loadLanguageModel(const char* model_path) {
+std::string ModelManager::resolveModelFile(const char* path) {
+    if (!ModelArchive::isArchive(path)) {
+        return path;
+    }
+
+    // The archive is kept as the compact copy. The GGUF decoded from it is a
+    // cache: the OS may purge it and the next load decodes it again.
+    std::string file = path;
+    size_t slash = file.find_last_of('/');
+    std::string name = file.substr(slash + 1);
+    const std::string ext = ".snpz";
+    if (name.size() > ext.size() && name.compare(name.size() - ext.size(), ext.size(), ext) == 0) {
+        name.resize(name.size() - ext.size());
+    }
+    std::string cached = model_cache_dir.empty() ? file.substr(0, slash + 1) + name : model_cache_dir + "/" + name;
+    if (cached == file) {
+        cached += ".gguf";
+    }
+    if (!ModelArchive::unpack(path, cached.c_str())) {
+        return "";
+    }
+    return cached;
+}
+
+void ModelManager::updateReadiness() {
+    int ready = 0;
+    if (model && lctx && batch.token && sampler && tmpls) {
+        ready |= READY_TEXT;
+        if (!mmproj_path.empty()) {
+            ready |= READY_IMAGE;
+        }
+        if (ctx_vision) {
+            ready |= READY_IMAGE_WARM;
+        }
+    }
+    readiness = ready;
+}
+
+bool ModelManager::loadLanguageModel(const char* path) {
     cleanup();  // Clean up any existing models first
-    
+    startup_profiler.begin();
+
+    std::string resolved;
+    {
+        StartupProfiler::Scope stage(startup_profiler, "lm.resolve");
+        resolved = resolveModelFile(path);
+    }
+    if (resolved.empty()) {
+        return false;
+    }
+    const char* model_path = resolved.c_str();
+
+    if (parallel_load) {
+        StartupProfiler::Scope stage(startup_profiler, "lm.prefetch");
+        FilePrefetcher prefetch;
+        if (!prefetch.start(model_path) || !prefetch.wait()) {
+            LOGi("Parallel read of %s failed, falling back to mmap faults", model_path);
+        }
+    }
+
+    // The first progress report comes once the file is opened and parsed and
+    // the backend buffers are allocated; tensor data is read (and repacked)
+    // from there on
+    int64_t t_load_us = ggml_time_us();
+    int64_t t_tensors_us = 0;
     llama_model_params model_params = llama_model_default_params();
     model_params.n_gpu_layers = 512;
+    model_params.progress_callback = [](float, void* user_data) {
+        int64_t* t_first_us = static_cast<int64_t*>(user_data);
+        if (*t_first_us == 0) {
+            *t_first_us = ggml_time_us();
+        }
+        return true;
+    };
+    model_params.progress_callback_user_data = &t_tensors_us;
     model = llama_model_load_from_file(model_path, model_params);
     if (!model) {
         LOGe("Failed to load language model from %s", model_path);
         return false;
     }
+    if (t_tensors_us != 0) {
+        startup_profiler.record("lm.parse_and_alloc", t_load_us, t_tensors_us);
+        startup_profiler.record("lm.tensor_data", t_tensors_us, ggml_time_us());
+    } else {
+        startup_profiler.record("lm.load", t_load_us, ggml_time_us());
+    }
     vocab = llama_model_get_vocab(model);
+    this->model_path = model_path;
+    return true;
+}
+
+bool ModelManager::loadVisionModel(const char* path) {
+    std::string resolved;
+    {
+        StartupProfiler::Scope stage(startup_profiler, "mmproj.resolve");
+        resolved = resolveModelFile(path);
+    }
+    if (resolved.empty()) {
+        return false;
+    }
+    const char* mmproj_path = resolved.c_str();
+
+    // Only the metadata is read here; the vision context is created on first image use
+    StartupProfiler::Scope stage(startup_profiler, "mmproj.metadata");
+    if (!preprocessor.load(mmproj_path)) {
+        LOGe("Failed to load vision model from %s", mmproj_path);
+        return false;
+    }
+    this->mmproj_path = mmproj_path;
+    if (parallel_load) {
+        mmproj_prefetch.start(mmproj_path);
+    }
+    updateReadiness();
     return true;
 }
 
-bool ModelManager::loadVisionModel(const char* mmproj_path) {
+// Creates the vision context on first use; vision_mutex must be held
+bool ModelManager::ensureVisionContext() {
+    if (ctx_vision) {
+        return true;
+    }
+    if (!model || mmproj_path.empty()) {
+        LOGe("Vision model not loaded");
+        return false;
+    }
+
+    mmproj_prefetch.wait();
+
+    StartupProfiler::Scope stage(startup_profiler, "vision_context");
+    int64_t t_start_us = ggml_time_us();
     mtmd_context_params mparams = mtmd_context_params_default();
     mparams.use_gpu = true;  // Enable GPU by default
     mparams.print_timings = true;
     mparams.n_threads = 1;
     mparams.verbosity = GGML_LOG_LEVEL_INFO;
-    
-    ctx_vision = mtmd_init_from_file(mmproj_path, model, mparams);
+
+    ctx_vision = mtmd_init_from_file(mmproj_path.c_str(), model, mparams);
     if (!ctx_vision) {
-        LOGe("Failed to load vision model from %s", mmproj_path);
+        LOGe("Failed to load vision model from %s", mmproj_path.c_str());
         return false;
     }
+    LOGi("Vision context created in %lld ms", (long long)(ggml_time_us() - t_start_us) / 1000);
+    updateReadiness();
     return true;
 }
 
+bool ModelManager::initializeVisionContext() {
+    std::lock_guard<std::mutex> vision_lock(vision_mutex);
+    return ensureVisionContext();
+}
+
 bool ModelManager::initializeContext() {
     llama_context_params ctx_params = llama_context_default_params();
     ctx_params.n_ctx = 4096;  // Adjust based on your needs
     ctx_params.n_batch = n_batch;
+    ctx_params.type_k = kv_type;
+    ctx_params.type_v = kv_type;
+    ctx_params.flash_attn = kv_type != GGML_TYPE_F16;  // quantized V needs flash attention
+    ctx_params.n_seq_max = kMaxSequences;  // one per resident session
     
-    lctx = llama_new_context_with_model(model, ctx_params);
+    // KV cache allocation and compute graph reservation
+    {
+        StartupProfiler::Scope stage(startup_profiler, "context");
+        lctx = llama_new_context_with_model(model, ctx_params);
+    }
     if (!lctx) {
         LOGe("Failed to create language context");
         return false;
     }
+    n_threads = llama_n_threads(lctx);
+    n_threads_batch = llama_n_threads_batch(lctx);
+
+    startMaintenance();
+    updateReadiness();
     return true;
 }
 
+void ModelManager::startMaintenance() {
+    maintenance.stop();
+    maintenance.clearTasks();
+
+    // Compact the KV cache after conversations grow, shrink or reset
+    maintenance.addTask("kv-defrag", 10000, [this]() {
+        if (kv_dirty.exchange(false)) {
+            ModelLock lock(*this);
+            llama_kv_self_defrag(lctx);
+            llama_kv_self_update(lctx);
+        }
+        return false;
+    });
+
+    // Fault weights evicted under memory pressure back in, 4 MiB per step.
+    // A pass only starts once mincore shows pages missing, so a fully
+    // resident model costs one residency check per interval and no reads.
+    if (model_pages.open(model_path.c_str())) {
+        maintenance.addTask("touch-weights", 60000, [this]() {
+            if (!touching_weights && !model_pages.hasEvicted()) {
+                return false;
+            }
+            touching_weights = model_pages.touchNext(4 << 20);
+            return touching_weights;
+        });
+    }
+
+    maintenance.start();
+}
+
 bool ModelManager::initializeBatch() {
+    StartupProfiler::Scope stage(startup_profiler, "batch");
     batch = llama_batch_init(n_batch, 0, 1);
+    updateReadiness();
     return true;
 }
 
-bool ModelManager::initializeSampler() {
+bool ModelManager::initializeSampler(float temperature) {
+    StartupProfiler::Scope stage(startup_profiler, "sampler");
     common_params_sampling sampling_params;
-    sampling_params.temp = 0.2f;  // Lower temperature for better quality
+    sampling_params.temp = temperature;  // Low by default for better quality; zero is greedy
     
     sampler = common_sampler_init(model, sampling_params);
     if (!sampler) {
         LOGe("Failed to initialize sampler");
         return false;
     }
+    updateReadiness();
     return true;
 }
 
-bool ModelManager::processImage(const char* image_path) {
-    mtmd::bitmap bmp(mtmd_helper_bitmap_init_from_file(image_path));
-    if (!bmp.ptr) {
+bool ModelManager::processImage(int session, const char* image_path, bool speculate) {
+    mtmd::bitmap decoded(mtmd_helper_bitmap_init_from_file(image_path));
+    if (!decoded.ptr) {
         LOGe("Failed to load image from %s", image_path);
         return false;
     }
-    
-    bitmaps.entries.push_back(std::move(bmp));
+
+    return processImagePixels(session, decoded.data(), decoded.nx(), decoded.ny(), decoded.nx() * 3, 3, true,
+                              speculate);
+}
+
+// Encoded image (JPEG, PNG, ...) already in memory
+bool ModelManager::processImageBuffer(int session, const uint8_t* data, size_t size) {
+    mtmd::bitmap decoded(mtmd_helper_bitmap_init_from_buf(data, size));
+    if (!decoded.ptr) {
+        LOGe("Failed to decode %zu byte image", size);
+        return false;
+    }
+
+    return processImagePixels(session, decoded.data(), decoded.nx(), decoded.ny(), decoded.nx() * 3, 3);
+}
+
+bool ModelManager::processImagePixels(int session, const uint8_t* pixels, int width, int height, int stride,
+                                      int channels, bool queue, bool speculate) {
+    mtmd::bitmap bmp = preprocessor.toBitmap(pixels, width, height, stride, channels);
+    if (!bmp.ptr) {
+        LOGe("Failed to preprocess image");
+        return false;
+    }
+    return ingestBitmap(session, std::move(bmp), queue, speculate);
+}
+
+// Splits a preprocessed image, starts its encode and queues it for the next
+// prompt; a capture also starts its speculative reply
+bool ModelManager::ingestBitmap(int session, mtmd::bitmap&& bmp, bool queue, bool speculate) {
+    size_t n_bytes = (size_t)bmp.nx() * bmp.ny() * 3;
+    std::string id = ImageEmbeddingCache::makeId(bmp.data(), n_bytes);
+    bmp.set_id(id.c_str());
+    LOGi("Ingested image %s at %ux%u", id.c_str(), bmp.nx(), bmp.ny());
+
+    std::vector<mtmd::bitmap> parts;
+    if (!splitSalientTiles(bmp, id, parts)) {
+        parts.push_back(std::move(bmp));
+    }
+    std::vector<mtmd::bitmap> spec_images;
+    if (speculate) {
+        spec_images = speculationImages(parts);
+    }
+    for (mtmd::bitmap& part : parts) {
+        if (queue) {
+            // The encoder gets its own copy; the queued one is consumed by the prompt
+            mtmd::bitmap copy(part.nx(), part.ny(), part.data());
+            copy.set_id(part.id().c_str());
+            addBitmap(session, std::move(part));
+            encodeAsync(std::move(copy));
+        } else {
+            encodeAsync(std::move(part));
+        }
+    }
+    if (!spec_images.empty()) {
+        startSpeculation(session, std::move(spec_images));
+    }
+    return true;
+}
+
+// Tiles worth encoding per image under the token and latency budgets; the
+// global view costs one tile of each
+int ModelManager::tileBudget(int n_tiles) const {
+    int k = n_tiles;
+    int tile_tokens = preprocessor.tileTokens();
+    if (image_budget_tokens > 0 && tile_tokens > 0) {
+        k = std::min(k, image_budget_tokens / tile_tokens - 1);
+    }
+    float tile_ms = tile_encode_ms.load();
+    if (image_budget_ms > 0.0f && tile_ms > 0.0f) {
+        k = std::min(k, (int)(image_budget_ms / tile_ms) - 1);
+    }
+    return std::max(k, 0);
+}
+
+// Replaces a tiled image with its most salient tiles in reading order plus a
+// global view last, the order the projector's own split uses (without its
+// tile markers, see cropTiles). Part ids extend the image id, so
+// generateResponse can expand the image's marker to one per part. Returns
+// false when the whole image should be encoded as is.
+bool ModelManager::splitSalientTiles(mtmd::bitmap& bmp, const std::string& id, std::vector<mtmd::bitmap>& parts) {
+    int tile_size = preprocessor.tileSize();
+    if ((image_budget_tokens <= 0 && image_budget_ms <= 0.0f) || tile_size <= 0 ||
+        ((int)bmp.nx() <= tile_size && (int)bmp.ny() <= tile_size)) {
+        return false;
+    }
+
+    int64_t t_start_us = ggml_time_us();
+    int width = bmp.nx();
+    int height = bmp.ny();
+    std::vector<SaliencyTiles::Tile> tiles = SaliencyTiles::rank(bmp.data(), width, height, tile_size);
+    if (tiles.empty()) {
+        return false;
+    }
+    size_t n_tiles = tiles.size();
+    size_t k = std::min(n_tiles, (size_t)tileBudget((int)n_tiles));
+    while (k > 0 && tiles[k - 1].score < kMinTileScore) {
+        k--;
+    }
+    if (k == n_tiles) {
+        return false;
+    }
+    tiles.resize(k);
+    cropTiles(bmp, id, tiles, tile_size, parts);
+    parts.push_back(globalPart(bmp, id, tile_size));
+
+    {
+        std::lock_guard<std::mutex> vision_lock(vision_mutex);
+        image_embeddings.ensureCapacity(2 * parts.size());
+        prepared_images.ensureCapacity(2 * parts.size());
+    }
+    LOGi("Image %s: encoding %zu of %zu tiles plus global view, ranked in %lld ms", id.c_str(), k, n_tiles,
+         (long long)(ggml_time_us() - t_start_us) / 1000);
+    return true;
+}
+
+bool ModelManager::processImages(int session, const char* const* image_paths, int n_images, int max_visual_tokens) {
+    if (!image_paths || n_images <= 0) {
+        return false;
+    }
+    struct Ingested {
+        mtmd::bitmap bmp;
+        mtmd::bitmap global;  // null when the image isn't tiled
+        std::string id;
+        std::vector<SaliencyTiles::Tile> tiles;
+    };
+    std::vector<Ingested> images(n_images);
+    const int tile_size = preprocessor.tileSize();
+    int64_t t_start_us = ggml_time_us();
+    {
+        std::lock_guard<std::mutex> vision_lock(vision_mutex);
+        image_embeddings.ensureCapacity(2 * (size_t)n_images);
+        prepared_images.ensureCapacity(2 * (size_t)n_images);
+    }
+
+    // Each image is decoded, preprocessed and ranked on its own thread. Every
+    // image keeps a global view, so those go to the encoder right away.
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n_images; i++) {
+        threads.emplace_back([&, i]() {
+            Ingested& image = images[i];
+            mtmd::bitmap decoded(mtmd_helper_bitmap_init_from_file(image_paths[i]));
+            if (!decoded.ptr) {
+                LOGe("Failed to load image from %s", image_paths[i]);
+                return;
+            }
+            mtmd::bitmap bmp = preprocessor.toBitmap(decoded.data(), decoded.nx(), decoded.ny(), decoded.nx() * 3, 3);
+            if (!bmp.ptr) {
+                LOGe("Failed to preprocess image %s", image_paths[i]);
+                return;
+            }
+            image.id = ImageEmbeddingCache::makeId(bmp.data(), (size_t)bmp.nx() * bmp.ny() * 3);
+            bmp.set_id(image.id.c_str());
+            if (tile_size > 0 && ((int)bmp.nx() > tile_size || (int)bmp.ny() > tile_size)) {
+                image.tiles = SaliencyTiles::rank(bmp.data(), bmp.nx(), bmp.ny(), tile_size);
+            }
+            if (!image.tiles.empty()) {
+                image.global.ptr = globalPart(bmp, image.id, tile_size).ptr;
+            }
+            mtmd::bitmap& first = image.global.ptr ? image.global : bmp;
+            mtmd::bitmap copy(first.nx(), first.ny(), first.data());
+            copy.set_id(first.id().c_str());
+            encodeAsync(std::move(copy));
+            image.bmp.ptr = std::move(bmp.ptr);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (int i = 0; i < n_images; i++) {
+        if (!images[i].bmp.ptr) {
+            return false;
+        }
+    }
+
+    // The rest of the budget buys the most salient tiles across all images
+    struct Candidate {
+        int image;
+        SaliencyTiles::Tile tile;
+    };
+    std::vector<Candidate> candidates;
+    for (int i = 0; i < n_images; i++) {
+        for (const SaliencyTiles::Tile& tile : images[i].tiles) {
+            if (tile.score >= kMinTileScore) {
+                candidates.push_back({i, tile});
+            }
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const Candidate& a, const Candidate& b) { return a.tile.score > b.tile.score; });
+    size_t n_extra = candidates.size();
+    int tile_tokens = preprocessor.tileTokens();
+    if (max_visual_tokens > 0 && tile_tokens > 0) {
+        int extra = max_visual_tokens / tile_tokens - n_images;
+        if (extra < 0) {
+            LOGi("Visual budget of %d tokens is below one view per image", max_visual_tokens);
+        }
+        n_extra = std::min(n_extra, (size_t)std::max(extra, 0));
+    } else if (max_visual_tokens > 0) {
+        LOGi("Tokens per tile unknown, visual budget ignored");
+    }
+    std::vector<std::vector<SaliencyTiles::Tile>> selected(n_images);
+    for (size_t c = 0; c < n_extra; c++) {
+        selected[candidates[c].image].push_back(candidates[c].tile);
+    }
+
+    // Resolution per image: one whose salient tiles outnumber its share of
+    // the budget is redrawn smaller, so the same number of tiles covers more
+    // of what it shows. Global views stay as they are.
+    threads.clear();
+    for (int i = 0; i < n_images; i++) {
+        size_t n_salient = 0;
+        for (const SaliencyTiles::Tile& tile : images[i].tiles) {
+            n_salient += tile.score >= kMinTileScore;
+        }
+        size_t share = selected[i].size();
+        if (share == 0 || share >= n_salient) {
+            continue;
+        }
+        int longest = (int)std::max(images[i].bmp.nx(), images[i].bmp.ny()) / tile_size;
+        int edge_tiles = (int)(longest * std::sqrt((double)share / n_salient));
+        if (edge_tiles < 2 || edge_tiles >= longest) {
+            continue;  // one tile adds nothing to the global view
+        }
+        threads.emplace_back([&, i, share, n_salient, edge_tiles]() {
+            Ingested& image = images[i];
+            int nx = (int)image.bmp.nx();
+            int ny = (int)image.bmp.ny();
+            mtmd::bitmap scaled = preprocessor.toBitmap(image.bmp.data(), nx, ny, nx * 3, 3, edge_tiles * tile_size);
+            if (!scaled.ptr) {
+                return;
+            }
+            std::vector<SaliencyTiles::Tile> ranked =
+                SaliencyTiles::rank(scaled.data(), scaled.nx(), scaled.ny(), tile_size);
+            std::vector<SaliencyTiles::Tile> picked;
+            for (const SaliencyTiles::Tile& tile : ranked) {
+                if (picked.size() >= share || tile.score < kMinTileScore) {
+                    break;
+                }
+                picked.push_back(tile);
+            }
+            if (picked.empty()) {
+                return;
+            }
+            LOGi("Image %d redrawn at %dx%d for %zu of its %zu salient tiles", i, (int)scaled.nx(), (int)scaled.ny(),
+                 picked.size(), n_salient);
+            image.id += "@" + std::to_string(edge_tiles * tile_size);
+            image.bmp.ptr = std::move(scaled.ptr);
+            selected[i] = std::move(picked);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<std::vector<mtmd::bitmap>> crops(n_images);
+    size_t n_views = 0;
+    for (int i = 0; i < n_images; i++) {
+        cropTiles(images[i].bmp, images[i].id, selected[i], tile_size, crops[i]);
+        n_views += crops[i].size() + 1;
+    }
+    {
+        std::lock_guard<std::mutex> vision_lock(vision_mutex);
+        image_embeddings.ensureCapacity(2 * n_views);
+        prepared_images.ensureCapacity(2 * n_views);
+    }
+    for (int i = 0; i < n_images; i++) {
+        Ingested& image = images[i];
+        if (!image.global.ptr) {
+            addBitmap(session, std::move(image.bmp));
+            continue;
+        }
+        for (mtmd::bitmap& crop : crops[i]) {
+            mtmd::bitmap copy(crop.nx(), crop.ny(), crop.data());
+            copy.set_id(crop.id().c_str());
+            encodeAsync(std::move(copy));
+            addBitmap(session, std::move(crop));
+        }
+        addBitmap(session, std::move(image.global));
+    }
+    LOGi("Queued %d images as %zu views (%zu tokens) in %lld ms", n_images, n_views, n_views * tile_tokens,
+         (long long)(ggml_time_us() - t_start_us) / 1000);
+    return true;
+}
+
+void ModelManager::encodeAsync(mtmd::bitmap&& bmp) {
+    std::call_once(encoder_started, [this]() {
+        encoder.start([this](mtmd::bitmap& bmp) { preEncode(bmp); });
+    });
+    encoder.submit(std::move(bmp));
+}
+
+// Runs on the encode worker, one image at a time
+void ModelManager::preEncode(mtmd::bitmap& bmp) {
+    MaintenanceRequestScope request(maintenance);
+    std::lock_guard<std::mutex> vision_lock(vision_mutex);
+    if (!ensureVisionContext() || image_embeddings.find(bmp.id())) {
+        return;
+    }
+
+    // Tokenize the image on its own to get a chunk the encoder accepts
+    mtmd_input_text text;
+    text.text = "<__image__>";
+    text.add_special = false;
+    text.parse_special = true;
+    const mtmd_bitmap* bmp_c_ptr = bmp.ptr.get();
+    mtmd::input_chunks chunks(mtmd_input_chunks_init());
+    if (mtmd_tokenize(ctx_vision, chunks.ptr.get(), &text, &bmp_c_ptr, 1) != 0) {
+        LOGe("Unable to tokenize image for pre-encoding");
+        return;
+    }
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (mtmd_input_chunk_get_type(chunks[i]) == MTMD_INPUT_CHUNK_TYPE_IMAGE) {
+            encodeImageChunk(chunks[i]);
+        }
+    }
+    prepared_images.put(bmp.id(), std::move(chunks.ptr));
+}
+
+void ModelManager::waitForEncode() {
+    encoder.waitIdle();
+}
+
+// Runs the encoder for an image chunk and caches the result; vision_mutex must be held
+const std::vector<float>* ModelManager::encodeImageChunk(const mtmd_input_chunk* chunk) {
+    const mtmd_image_tokens* image_tokens = mtmd_input_chunk_get_tokens_image(chunk);
+    std::string id = mtmd_image_tokens_get_id(image_tokens);
+    if (const std::vector<float>* embd = image_embeddings.find(id)) {
+        return embd;
+    }
+
+    int64_t t_start_us = ggml_time_us();
+    if (mtmd_encode(ctx_vision, image_tokens) != 0) {
+        LOGe("Failed to encode image %s", id.c_str());
+        return nullptr;
+    }
+    size_t n_floats = mtmd_image_tokens_get_n_tokens(image_tokens) * llama_model_n_embd(model);
+    const float* out = mtmd_get_output_embd(ctx_vision);
+    std::vector<float> embd = image_embeddings.buffer(n_floats);
+    std::copy(out, out + n_floats, embd.begin());
+    image_embeddings.put(id, std::move(embd));
+    n_encodes++;
+    encode_us += ggml_time_us() - t_start_us;
+
+    // Per-tile cost feeds the latency budget of selective tiling
+    size_t n_tokens = mtmd_image_tokens_get_n_tokens(image_tokens);
+    int tile_tokens = preprocessor.tileTokens();
+    double n_tiles = tile_tokens > 0 && n_tokens > 0 ? (double)n_tokens / tile_tokens : 1.0;
+    float tile_ms = (float)((ggml_time_us() - t_start_us) / 1000.0 / std::max(n_tiles, 1.0));
+    float prev_ms = tile_encode_ms.load();
+    tile_encode_ms = prev_ms > 0.0f ? 0.8f * prev_ms + 0.2f * tile_ms : tile_ms;
+    LOGi("Encoded image %s in %lld ms", id.c_str(), (long long)(ggml_time_us() - t_start_us) / 1000);
+    return image_embeddings.find(id);
+}
+
+void ModelManager::addBitmap(int session, mtmd::bitmap&& bmp) {
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    pending_images[session].entries.push_back(std::move(bmp));
+}
+
+void ModelManager::clearBitmaps(int session) {
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        pending_images.erase(session);
+    }
+    std::shared_ptr<Session> s = findSession(session);
+    if (s && s->owner.load() == std::this_thread::get_id()) {
+        s->bitmaps.entries.clear();
+    }
+}
+
+// Queues a session's tokens for the next batched steps and waits until they
+// are all decoded. Whichever waiting thread finds the model free leads: it
+// decodes one step for everything queued, then hands over. Background work
+// only leads when no foreground thread is waiting, so a speculation thread
+// doesn't run foreground steps at its own priority.
+bool ModelManager::runStep(Session& s, const llama_token* tokens, int n_tokens, bool decode, bool sample,
+                           bool low_power, const std::atomic<bool>* stop) {
+    if (n_tokens <= 0) {
+        return true;
+    }
+    StepWork work;
+    work.session = &s;
+    work.tokens = tokens;
+    work.n_tokens = n_tokens;
+    work.decode = decode;
+    work.sample = sample;
+    work.low_power = low_power;
+    work.background = speculating;
+    work.stop = stop ? stop : s.stop;
+
+    std::unique_lock<std::mutex> lock(model_mutex);
+    step_queue.push_back(&work);
+    while (!work.done) {
+        bool foreground_waiting = std::any_of(step_queue.begin(), step_queue.end(),
+                                              [](const StepWork* w) { return !w->background; });
+        if (model_busy || (work.background && foreground_waiting)) {
+            model_cv.wait(lock);
+            continue;
+        }
+        model_busy = true;
+        model_owner = std::this_thread::get_id();
+        model_depth = 1;
+        std::vector<StepWork*> works = step_queue;
+        lock.unlock();
+        decodeStep(works);
+        lock.lock();
+        model_busy = false;
+        model_owner = std::thread::id();
+        model_depth = 0;
+
+        // Waiters only look at their work once it is done, under model_mutex
+        for (StepWork* w : works) {
+            w->done = !w->ok || w->n_done == w->n_tokens;
+        }
+        step_queue.erase(std::remove_if(step_queue.begin(), step_queue.end(), [](const StepWork* w) { return w->done; }),
+                         step_queue.end());
+        model_cv.notify_all();
+    }
+    return work.ok;
+}
+
+// One step for the queued works, split by the scheduler; the model is held.
+// A work that asks for it gets its next token sampled from its last row.
+void ModelManager::decodeStep(const std::vector<StepWork*>& works) {
+    std::vector<FairScheduler::Demand> demands(works.size());
+    for (size_t i = 0; i < works.size(); i++) {
+        StepWork& w = *works[i];
+        if (w.stop && w.stop->load()) {
+            w.ok = false;
+        }
+        demands[i].session = w.session->id;
+        demands[i].n_tokens = w.ok ? w.n_tokens - w.n_done : 0;
+        demands[i].decode = w.decode;
+        demands[i].expected = w.session->expected_tokens;
+        demands[i].background = w.background;
+    }
+    std::vector<int> grants = scheduler.plan(demands, n_batch);
+
+    auto decode = [&](const std::vector<size_t>& granted) {
+        std::vector<int> rows(works.size(), -1);
+        bool low = true;
+        common_batch_clear(batch);
+        for (size_t i : granted) {
+            StepWork& w = *works[i];
+            low = low && w.low_power;
+            for (int k = 0; k < grants[i]; k++) {
+                bool logits = w.sample && w.n_done + k == w.n_tokens - 1;
+                if (logits) {
+                    rows[i] = batch.n_tokens;
+                }
+                common_batch_add(batch, w.tokens[w.n_done + k], w.session->n_past + k, {w.session->seq}, logits);
+            }
+        }
+        setLowPower(low);
+
+        int32_t res = llama_decode(lctx, batch);
+        if (res == 1 && evictIdleSequence()) {
+            // No room in the cache for the step; an idle session made some
+            llama_kv_self_defrag(lctx);
+            llama_kv_self_update(lctx);
+            res = llama_decode(lctx, batch);
+        }
+        for (size_t i : granted) {
+            StepWork& w = *works[i];
+            if (res != 0) {
+                w.ok = false;
+                continue;
+            }
+            w.session->n_past += grants[i];
+            w.n_done += grants[i];
+            if (rows[i] >= 0) {
+                w.session->next_token = common_sampler_sample(w.session->sampler, lctx, rows[i]);
+            }
+        }
+        return res;
+    };
+
+    std::vector<size_t> granted;
+    for (size_t i = 0; i < works.size(); i++) {
+        if (grants[i] > 0) {
+            granted.push_back(i);
+        }
+    }
+    if (granted.empty()) {
+        return;
+    }
+    int32_t res = decode(granted);
+    if (res != 0 && granted.size() > 1) {
+        // Only the sessions whose own tokens don't fit fail
+        LOGi("Batched step of %zu sessions failed, res = %d, decoding them one by one", granted.size(), res);
+        for (size_t i : granted) {
+            works[i]->ok = true;
+            if (decode({i}) != 0) {
+                LOGe("Step of session %d failed", works[i]->session->id);
+            }
+        }
+    } else if (res != 0) {
+        LOGe("Step of session %d failed, res = %d", works[granted[0]]->session->id, res);
+    }
+}
+
+// Low-power steps run on a single thread; the model is held
+void ModelManager::setLowPower(bool on) {
+    if (on == low_power || !lctx || n_threads <= 0) {
+        return;
+    }
+    low_power = on;
+    llama_set_n_threads(lctx, on ? 1 : n_threads, on ? 1 : n_threads_batch);
+}
+
+bool ModelManager::generateResponse(int session, const char* prompt, int max_tokens, TokenCallback callback,
+                                    bool paced) {
+    SessionTurn turn(*this, session, prompt);
+    if (!turn.ok()) {
+        return false;
+    }
+    Session& s = turn.session();
+    kv_dirty = true;
+
+    ReplyState reply;
+    bool has_image = true;
+    if (turn.adoptedSpeculation()) {
+        reply = std::move(s.speculation.reply);
+        s.speculation = Speculation();
+        s.expected_tokens = std::max(length_predictor.predict(prompt, true, max_tokens).expected -
+                                     (int)reply.tokens.size(), 0);
+        LOGi("Adopted speculative reply, %zu tokens buffered", reply.tokens.size());
+        if (!reply.text.empty()) {
+            callback(reply.text);
+        }
+    } else if (!prefillPrompt(s, prompt, max_tokens, has_image)) {
+        return false;
+    }
+
+    if (!runReply(s, reply, max_tokens, callback, paced, nullptr)) {
+        return false;
+    }
+    finishReply(s, reply);
+    length_predictor.record(prompt, has_image, s.n_generated);
     return true;
 }
 
-void ModelManager::addBitmap(mtmd::bitmap&& bmp) {
-    bitmaps.entries.push_back(std::move(bmp));
+void ModelManager::finishResponse(int session) {
+    std::shared_ptr<Session> s = findSession(session);
+    if (s) {
+        s->pacer.finishNow();
+    }
 }
 
-bool ModelManager::generateResponse(const char* prompt, int max_tokens, TokenCallback callback) {
+// Adds the queued images' markers and prefills the user turn
+bool ModelManager::prefillPrompt(Session& s, const char* prompt, int max_tokens, bool& has_image) {
     std::string str_prompt(prompt);
-    if(str_prompt.find("<__image__>") == std::string::npos) {
+    has_image = !s.bitmaps.entries.empty();
+    size_t n_images = imageGroups(s.bitmaps).size();
+    if (n_images == 1 && str_prompt.find("<__image__>") == std::string::npos) {
         str_prompt = " <__image__> " + str_prompt;
+    } else if (n_images > 1 && str_prompt.find("<__image__>") == std::string::npos) {
+        // Numbered so the prompt can refer to each image
+        std::string markers;
+        for (size_t i = 0; i < n_images; i++) {
+            markers += "Image " + std::to_string(i + 1) + ": <__image__>\n";
+        }
+        str_prompt = markers + str_prompt;
     }
-    
-    if (!evalMessage(str_prompt.c_str(), true)) {  // Add BOS token for first message
+
+    // The expected length puts short replies' steps first
+    OutputLengthPredictor::Prediction prediction = length_predictor.predict(prompt, has_image, max_tokens);
+    s.reserve_tokens = prediction.p95;
+    s.expected_tokens = prediction.expected;
+    bool ok = evalMessage(s, str_prompt.c_str(), true);  // Add BOS token for first message
+    s.reserve_tokens = 0;
+    return ok;
+}
+
+// Samples the reply to the prompt already evaluated and records it in the history
+bool ModelManager::generateTokens(Session& s, int max_tokens, TokenCallback callback, bool paced) {
+    ReplyState reply;
+    if (!runReply(s, reply, max_tokens, callback, paced, nullptr)) {
         return false;
     }
+    finishReply(s, reply);
+    return true;
+}
+
+bool ModelManager::runReply(Session& s, ReplyState& reply, int max_tokens, TokenCallback callback, bool paced,
+                            const std::atomic<bool>* stop) {
+    const llama_pos n_ctx = llama_n_ctx(lctx);
+    int64_t t_last_token_us = 0;
+    bool ok = true;
+
+    if (paced) {
+        s.pacer.begin(decode_rate.load());
+    }
+
+    while (!reply.finished && (int)reply.tokens.size() < max_tokens && s.n_past < n_ctx) {
+        if (stop && stop->load()) {
+            break;
+        }
+
+        if (reply.undecoded != LLAMA_TOKEN_NULL) {
+            // Wait out the schedule before asking for the next step; nothing
+            // of the model is held meanwhile, so other sessions carry on
+            if (paced) {
+                s.pacer.afterToken();
+            }
 
-    llama_tokens generated_tokens;
-    int n_predict = max_tokens;
+            // Evaluate the token in a step batched with other sessions'; its
+            // logits are sampled within the step
+            if (!runStep(s, &reply.undecoded, 1, true, true, paced && s.pacer.lowPower(), stop)) {
+                if (stop && stop->load()) {
+                    break;
+                }
+                resetConversation(s);
+                ok = false;
+                break;
+            }
+            s.kv_text += reply.undecoded_piece;
+            reply.undecoded = LLAMA_TOKEN_NULL;
+        }
 
-    for (int i = 0; i < n_predict; i++) {
-        llama_token token_id = common_sampler_sample(sampler, lctx, -1);
-        generated_tokens.push_back(token_id);
-        common_sampler_accept(sampler, token_id, true);
+        llama_token token_id = s.next_token;
+        s.next_token = LLAMA_TOKEN_NULL;
+        if (token_id == LLAMA_TOKEN_NULL) {
+            LOGe("No logits to sample the reply from");
+            ok = false;
+            break;
+        }
+        reply.tokens.push_back(token_id);
+        common_sampler_accept(s.sampler, token_id, true);
+        s.expected_tokens = std::max(s.expected_tokens - 1, 0);
 
-        if (llama_vocab_is_eog(vocab, token_id) || checkAntiprompt(generated_tokens)) {
+        if (llama_vocab_is_eog(vocab, token_id) || checkAntiprompt(reply.tokens)) {
+            reply.finished = true;
             break;
         }
 
@@ -130,34 +1149,215 @@ bool ModelManager::generateResponse(const char* prompt, int max_tokens, TokenCal
             LOGi("Generated token: %s", token_text.c_str());
             callback(token_text);
             LOGi("Callback executed for token: %s", token_text.c_str());
-        }
 
-        // Check if we've generated enough tokens
-        if (i >= n_predict - 1) {
-            break;
+            int64_t now_us = ggml_time_us();
+            if (t_last_token_us != 0) {
+                scheduler.recordTokenGap(s.id, (now_us - t_last_token_us) / 1000.0);
+            }
+            t_last_token_us = now_us;
         }
+        reply.text += token_text;
+        reply.undecoded = token_id;
+        reply.undecoded_piece = token_text;
+    }
 
-        // Evaluate the token
-        common_batch_clear(batch);
-        common_batch_add(batch, token_id, n_past++, {0}, true);
-        if (llama_decode(lctx, batch)) {
-            return false;
+    if (paced) {
+        s.pacer.end();
+    }
+    s.expected_tokens = 0;
+    return ok;
+}
+
+// Record the reply so the next turn only has to prefill its own delta
+void ModelManager::finishReply(Session& s, const ReplyState& reply) {
+    s.n_generated = (int)reply.tokens.size();
+    common_chat_msg msg;
+    msg.role = "assistant";
+    msg.content = reply.text;
+    s.chat_history.push_back(std::move(msg));
+    s.kv_marks.push_back({s.kv_text.size(), s.n_past});
+}
+
+void ModelManager::setSpeculativePrompt(const char* prompt, int max_tokens) {
+    std::lock_guard<std::mutex> lock(spec_mutex);
+    spec_prompt = prompt ? prompt : "";
+    spec_max_tokens = max_tokens;
+}
+
+// Copies of an ingested image's parts for speculation, none when it is off
+std::vector<mtmd::bitmap> ModelManager::speculationImages(std::vector<mtmd::bitmap>& parts) {
+    std::vector<mtmd::bitmap> images;
+    std::lock_guard<std::mutex> lock(spec_mutex);
+    if (spec_prompt.empty() || spec_max_tokens <= 0) {
+        return images;
+    }
+    for (mtmd::bitmap& part : parts) {
+        images.emplace_back(part.nx(), part.ny(), part.data());
+        images.back().set_id(part.id().c_str());
+    }
+    return images;
+}
+
+// Restarts speculation for the image's session on a new image
+void ModelManager::startSpeculation(int session, std::vector<mtmd::bitmap>&& images) {
+    std::lock_guard<std::mutex> lock(spec_mutex);
+    if (spec_prompt.empty() || spec_max_tokens <= 0) {
+        return;
+    }
+    std::vector<std::string> ids;
+    for (mtmd::bitmap& bmp : images) {
+        ids.push_back(bmp.id());
+    }
+
+    // Queuing the image that was pre-encoded for the prompt keeps it going
+    if (spec_session == session && ids == spec_image_ids) {
+        return;
+    }
+    if (spec_thread.joinable()) {
+        spec_stop = true;
+        spec_thread.join();
+    }
+    spec_stop = false;
+    spec_session = session;
+    spec_image_ids = ids;
+    spec_thread = std::thread(&ModelManager::speculate, this, spec_session, spec_prompt, spec_max_tokens,
+                              std::move(images));
+}
+
+void ModelManager::stopSpeculation(int session) {
+    std::lock_guard<std::mutex> lock(spec_mutex);
+    if (!spec_thread.joinable() || (session >= 0 && session != spec_session)) {
+        return;
+    }
+    spec_stop = true;
+    spec_thread.join();
+    // A stopped speculation is gone; the same images may start it again
+    spec_session = -1;
+    spec_image_ids.clear();
+}
+
+void ModelManager::speculate(int session, std::string prompt, int max_tokens, std::vector<mtmd::bitmap> images) {
+#if defined(__APPLE__)
+    pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0);
+#endif
+    speculating = true;
+
+    // The turn settles the previous speculation of the session
+    waitForEncode();
+    SessionTurn turn(*this, session, nullptr, &spec_stop);
+    if (!turn.ok() || spec_stop) {
+        return;
+    }
+    Session& s = turn.session();
+    if (s.speculation.active) {
+        return;
+    }
+    kv_dirty = true;
+    int64_t t_start_us = ggml_time_us();
+
+    Speculation spec;
+    spec.prompt = prompt;
+    spec.n_past = s.n_past;
+    spec.history_size = s.chat_history.size();
+    spec.kv_text_size = s.kv_text.size();
+    spec.image_spans = s.image_spans;
+    for (mtmd::bitmap& bmp : images) {
+        spec.image_ids.push_back(bmp.id());
+    }
+    s.speculation = std::move(spec);
+
+    // The prompt sees only the speculated image; anything queued stays queued
+    std::vector<mtmd::bitmap> queued = std::move(s.bitmaps.entries);
+    s.bitmaps.entries = std::move(images);
+    bool has_image = true;
+    bool ok = prefillPrompt(s, prompt.c_str(), max_tokens, has_image);
+    s.bitmaps.entries = std::move(queued);
+    if (!ok) {
+        rollbackSpeculation(s);
+        return;
+    }
+    s.speculation.active = true;
+    if (!runReply(s, s.speculation.reply, max_tokens, [](const std::string&) {}, false, &spec_stop)) {
+        rollbackSpeculation(s);
+        return;
+    }
+    LOGi("Speculated %zu reply tokens in %lld ms", s.speculation.reply.tokens.size(),
+         (long long)(ggml_time_us() - t_start_us) / 1000);
+}
+
+// Called at the start of a session's turn: a reply speculated for the same
+// prompt is adopted, anything else rolls the conversation back to before it
+bool ModelManager::settleSpeculation(Session& s, const char* prompt) {
+    Speculation& spec = s.speculation;
+    if (!spec.active) {
+        return false;
+    }
+    if (prompt && spec.prompt == prompt) {
+        // A hit when nothing or just the speculated image was queued since
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        auto it = pending_images.find(s.id);
+        bool same_images = it == pending_images.end();
+        if (!same_images && it->second.entries.size() == spec.image_ids.size()) {
+            same_images = true;
+            for (size_t i = 0; i < spec.image_ids.size(); i++) {
+                same_images = same_images && it->second.entries[i].id() == spec.image_ids[i];
+            }
+        }
+        if (same_images) {
+            if (it != pending_images.end()) {
+                pending_images.erase(it);
+            }
+            spec.active = false;
+            return true;
         }
     }
+    rollbackSpeculation(s);
+    return false;
+}
 
-    return true;
+// Drops a speculative reply and everything it prefilled
+void ModelManager::rollbackSpeculation(Session& s) {
+    Speculation spec = std::move(s.speculation);
+    s.speculation = Speculation();
+    if (spec.reset) {
+        LOGi("Dropped speculative reply of %zu tokens, which restarted the conversation", spec.reply.tokens.size());
+        resetConversation(s);
+        s.speculation = Speculation();
+        return;
+    }
+
+    {
+        ModelLock lock(*this);
+        llama_kv_self_seq_rm(lctx, s.seq, spec.n_past, -1);
+    }
+    s.n_past = spec.n_past;
+    s.chat_history.resize(spec.history_size);
+    s.kv_text.resize(spec.kv_text_size);
+    while (!s.kv_marks.empty() && s.kv_marks.back().text_size > s.kv_text.size()) {
+        s.kv_marks.pop_back();
+    }
+    s.image_spans = std::move(spec.image_spans);
+    s.next_token = LLAMA_TOKEN_NULL;
+    common_sampler_reset(s.sampler);
+    kv_dirty = true;
+    LOGi("Dropped speculative reply of %zu tokens", spec.reply.tokens.size());
 }
 
 // Keep the original implementation for backward compatibility
-std::string ModelManager::generateResponse(const char* prompt, int max_tokens) {
+std::string ModelManager::generateResponse(int session, const char* prompt, int max_tokens) {
     std::string result;
-    generateResponse(prompt, max_tokens, [&result](const std::string& token) {
+    generateResponse(session, prompt, max_tokens, [&result](const std::string& token) {
         result += token;
     });
     return result;
 }
 
-bool ModelManager::evalMessage(const char* prompt, bool add_bos) {
+bool ModelManager::evalMessage(int session, const char* prompt, bool add_bos) {
+    SessionTurn turn(*this, session);
+    return turn.ok() && evalMessage(turn.session(), prompt, add_bos);
+}
+
+bool ModelManager::evalMessage(Session& s, const char* prompt, bool add_bos) {
     if (!tmpls) {
         LOGe("Chat templates not initialized");
         return false;
@@ -168,68 +1368,661 @@ bool ModelManager::evalMessage(const char* prompt, bool add_bos) {
     msg.role = "user";
     msg.content = prompt;
 
-    // Format chat message using templates
-    common_chat_templates_inputs tmpl_inputs;
-    tmpl_inputs.messages = {msg};
-    tmpl_inputs.add_generation_prompt = true;
-    tmpl_inputs.use_jinja = false;  // jinja is buggy here
-    auto formatted_chat = common_chat_templates_apply(tmpls.get(), tmpl_inputs);
-    LOGi("formatted_chat.prompt: %s", formatted_chat.prompt.c_str());
+    evictImages(s, !s.bitmaps.entries.empty());
 
-    mtmd_input_text text;
-    text.text = formatted_chat.prompt.c_str();
-    text.add_special = add_bos;
-    text.parse_special = true;
+    // Only the part of the transcript that is not already in the KV cache is prefilled
+    std::string delta = formatDelta(s, msg);
+    LOGi("formatted delta: %s", delta.c_str());
 
-    LOGi("Input text: %s", text.text);
-    LOGi("add_special: %d", text.add_special);
-    LOGi("parse_special: %d", text.parse_special);
+    bool ok = s.bitmaps.entries.empty() ? evalTextDelta(s, msg, delta, add_bos)
+                                        : evalImageDelta(s, msg, delta, add_bos);
+    if (!ok) {
+        return false;
+    }
 
-    mtmd::input_chunks chunks(mtmd_input_chunks_init());
-    auto& bitmaps = getBitmaps();  // Use non-const reference since c_ptr() isn't const
+    s.chat_history.push_back(std::move(msg));
+    s.kv_text += delta;
+    s.kv_marks.push_back({s.kv_text.size(), s.n_past});
+    return true;
+}
+
+// Text-only turns skip mtmd entirely and tokenize with the LM vocab
+bool ModelManager::evalTextDelta(Session& s, const common_chat_msg& msg, std::string& delta, bool add_bos) {
+    llama_tokens tokens = common_tokenize(vocab, delta, add_bos && s.n_past == 0, true);
+
+    // Start over with just this message if the transcript no longer fits
+    if (s.n_past > 0 && s.n_past + (llama_pos)tokens.size() + s.reserve_tokens >= llama_n_ctx(lctx)) {
+        LOGi("Conversation exceeds context window, starting a new one");
+        resetConversation(s);
+        delta = formatDelta(s, msg);
+        tokens = common_tokenize(vocab, delta, add_bos, true);
+    }
+
+    if (!evalTokens(s, tokens)) {
+        if (s.stopRequested()) {
+            return false;  // the caller rolls back what was prefilled
+        }
+        LOGe("Unable to eval prompt");
+        resetConversation(s);
+        return false;
+    }
+    return true;
+}
+
+// Prefill is queued whole; the scheduler splits it into chunks between other
+// sessions' reply tokens. The last token's logits give the reply's first token.
+bool ModelManager::evalTokens(Session& s, const llama_tokens& tokens) {
+    if (tokens.empty()) {
+        return false;
+    }
+    return runStep(s, tokens.data(), (int)tokens.size(), false, true);
+}
+
+bool ModelManager::evalImageDelta(Session& s, const common_chat_msg& msg, std::string& delta, bool add_bos) {
+    // Pre-encoding shares ctx_vision; let it finish so its result is reused
+    waitForEncode();
+    std::lock_guard<std::mutex> vision_lock(vision_mutex);
+    if (!ensureVisionContext()) {
+        return false;
+    }
+
+    auto& bitmaps = s.bitmaps;  // Use non-const reference since c_ptr() isn't const
     auto bitmaps_c_ptr = bitmaps.c_ptr();
-    
+
     LOGi("Number of bitmaps: %zu", bitmaps_c_ptr.size());
-    
-    int32_t res = mtmd_tokenize(ctx_vision,
-                               chunks.ptr.get(),
-                               &text,
-                               bitmaps_c_ptr.data(),
-                               bitmaps_c_ptr.size());
-    if (res != 0) {
-        LOGe("Unable to tokenize prompt, res = %d", res);
-        LOGe("Context vision: %p", ctx_vision);
-        LOGe("Chunks ptr: %p", chunks.ptr.get());
-        LOGe("Text ptr: %p", &text);
-        LOGe("Bitmaps data: %p", bitmaps_c_ptr.data());
+
+    // Images pre-encoded at ingest come with the chunks their encode tokenized.
+    // With those only the text between markers is tokenized here, and the
+    // projector's preprocessing doesn't run a second time.
+    std::vector<mtmd::input_chunks_ptr> prepared;
+    bool all_prepared = !bitmaps.entries.empty();
+    for (mtmd::bitmap& bmp : bitmaps.entries) {
+        all_prepared = all_prepared && prepared_images.contains(bmp.id());
+    }
+    for (size_t i = 0; all_prepared && i < bitmaps.entries.size(); i++) {
+        prepared.push_back(prepared_images.take(bitmaps.entries[i].id()));
+    }
+
+    // Prefill order: text tokens, or a chunk of the prompt or of a prepared image
+    struct Segment {
+        llama_tokens tokens;
+        const mtmd_input_chunk* chunk = nullptr;
+    };
+
+    auto splitPrepared = [&](const std::string& expanded, bool add_special, std::vector<Segment>& segments) {
+        const std::string marker = "<__image__>";
+        std::vector<std::string> parts;
+        size_t pos = 0;
+        for (size_t found; (found = expanded.find(marker, pos)) != std::string::npos; pos = found + marker.size()) {
+            parts.push_back(expanded.substr(pos, found - pos));
+        }
+        parts.push_back(expanded.substr(pos));
+        if (parts.size() != prepared.size() + 1) {
+            return false;
+        }
+
+        // Same split and special token handling as mtmd_tokenize
+        for (size_t i = 0; i < parts.size(); i++) {
+            llama_tokens tokens = common_tokenize(vocab, parts[i], add_special && i == 0, true);
+            if (!tokens.empty()) {
+                segments.push_back({std::move(tokens), nullptr});
+            }
+            if (i < prepared.size()) {
+                for (size_t c = 0; c < mtmd_input_chunks_size(prepared[i].get()); c++) {
+                    segments.push_back({llama_tokens(), mtmd_input_chunks_get(prepared[i].get(), c)});
+                }
+            }
+        }
+        return true;
+    };
+
+    auto tokenize = [&](mtmd::input_chunks& chunks, std::vector<Segment>& segments) {
+        segments.clear();
+        std::string expanded = expandImageMarkers(delta, bitmaps);
+        mtmd_input_text text;
+        text.text = expanded.c_str();
+        text.add_special = add_bos && s.n_past == 0;
+        text.parse_special = true;
+
+        LOGi("Input text: %s", text.text);
+        LOGi("add_special: %d", text.add_special);
+        LOGi("parse_special: %d", text.parse_special);
+
+        if (!prepared.empty()) {
+            if (splitPrepared(expanded, text.add_special, segments)) {
+                return true;
+            }
+            LOGi("Image markers don't match the prepared images, tokenizing again");
+            prepared.clear();
+            segments.clear();
+        }
+
+        int32_t res = mtmd_tokenize(ctx_vision,
+                                   chunks.ptr.get(),
+                                   &text,
+                                   bitmaps_c_ptr.data(),
+                                   bitmaps_c_ptr.size());
+        if (res != 0) {
+            LOGe("Unable to tokenize prompt, res = %d", res);
+            LOGe("Context vision: %p", ctx_vision);
+            LOGe("Chunks ptr: %p", chunks.ptr.get());
+            LOGe("Text ptr: %p", &text);
+            LOGe("Bitmaps data: %p", bitmaps_c_ptr.data());
+            return false;
+        }
+        for (size_t i = 0; i < chunks.size(); i++) {
+            segments.push_back({llama_tokens(), chunks[i]});
+        }
+        return true;
+    };
+
+    auto countPos = [](const std::vector<Segment>& segments) {
+        llama_pos n_pos = 0;
+        for (const Segment& segment : segments) {
+            if (!segment.chunk) {
+                n_pos += (llama_pos)segment.tokens.size();
+            } else if (mtmd_input_chunk_get_type(segment.chunk) == MTMD_INPUT_CHUNK_TYPE_IMAGE) {
+                n_pos += mtmd_image_tokens_get_n_pos(mtmd_input_chunk_get_tokens_image(segment.chunk));
+            } else {
+                size_t n_tokens = 0;
+                mtmd_input_chunk_get_tokens_text(segment.chunk, &n_tokens);
+                n_pos += (llama_pos)n_tokens;
+            }
+        }
+        return n_pos;
+    };
+
+    mtmd::input_chunks chunks(mtmd_input_chunks_init());
+    std::vector<Segment> segments;
+    if (!tokenize(chunks, segments)) {
         return false;
     }
 
+    // Start over with just this message if the transcript no longer fits
+    if (s.n_past > 0 && s.n_past + countPos(segments) + s.reserve_tokens >= llama_n_ctx(lctx)) {
+        LOGi("Conversation exceeds context window, starting a new one");
+        resetConversation(s);
+        delta = formatDelta(s, msg);
+        chunks.ptr.reset(mtmd_input_chunks_init());
+        if (!tokenize(chunks, segments)) {
+            return false;
+        }
+    }
+
     // Clear bitmaps after tokenization
     bitmaps.entries.clear();
 
-    llama_pos new_n_past;
-    if (mtmd_helper_eval_chunks(ctx_vision,
-                               lctx,
-                               chunks.ptr.get(),
-                               n_past,
-                               0,  // seq_id
-                               n_batch,
-                               true,  // logits_last
-                               &new_n_past)) {
-        LOGe("Unable to eval prompt");
+    // Images come from the embedding cache when they were encoded at ingest
+    // time and are decoded with the model held; text goes through the step
+    // engine, batched with other sessions' steps
+    size_t n_segments = segments.size();
+    for (size_t i = 0; i < n_segments; i++) {
+        if (s.stopRequested()) {
+            return false;  // the caller rolls back what was prefilled
+        }
+        const Segment& segment = segments[i];
+        bool last = i == n_segments - 1;
+        bool ok = true;
+        if (!segment.chunk) {
+            ok = runStep(s, segment.tokens.data(), (int)segment.tokens.size(), false, last);
+        } else if (mtmd_input_chunk_get_type(segment.chunk) == MTMD_INPUT_CHUNK_TYPE_IMAGE) {
+            const std::vector<float>* embd = encodeImageChunk(segment.chunk);
+            ImageSpan span;
+            span.p0 = s.n_past;
+            span.msg_index = s.chat_history.size();
+            llama_pos new_n_past = s.n_past;
+            ModelLock lock(*this);
+            ok = embd && mtmd_helper_decode_image_chunk(ctx_vision, lctx, segment.chunk, const_cast<float*>(embd->data()),
+                                                        s.n_past, s.seq, n_batch, &new_n_past) == 0;
+            s.n_past = new_n_past;
+            span.p1 = s.n_past;
+            s.image_spans.push_back(span);
+            n_image_tokens += span.p1 - span.p0;
+        } else {
+            size_t n_tokens = 0;
+            const llama_token* tokens = mtmd_input_chunk_get_tokens_text(segment.chunk, &n_tokens);
+            ok = runStep(s, tokens, (int)n_tokens, false, last);
+        }
+        if (!ok) {
+            if (s.stopRequested()) {
+                return false;
+            }
+            LOGe("Unable to eval prompt");
+            resetConversation(s);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Drops the KV cells of images that are no longer the focus. The transcript
+// text keeps their markers, so later deltas are unaffected; only the cached
+// image tokens go, and later positions move down over the freed range.
+void ModelManager::evictImages(Session& s, bool new_image) {
+    // Speculation is rolled back by position, so it never compacts
+    if (image_retention_turns <= 0 || s.image_spans.empty() || s.shared_prefix_n_past >= 0 || !lctx || speculating) {
+        return;
+    }
+
+    // M-RoPE positions can't be shifted or filled with plain text tokens, so
+    // those images are only dropped
+    bool mrope = false;
+    {
+        std::lock_guard<std::mutex> vision_lock(vision_mutex);
+        mrope = ctx_vision && mtmd_decode_use_mrope(ctx_vision);
+    }
+    bool compact = !mrope && llama_kv_self_can_shift(lctx);
+    ModelLock lock(*this);
+
+    // Back to front, so shifting a span's successors never moves one still to visit
+    for (size_t i = s.image_spans.size(); i-- > 0;) {
+        ImageSpan span = s.image_spans[i];
+        size_t turns = (s.chat_history.size() - span.msg_index) / 2;  // a user message and a reply each
+        if (!new_image && turns < (size_t)image_retention_turns) {
+            continue;
+        }
+
+        // One summary per message, in place of its first image
+        llama_tokens summary;
+        if (summarize_images && !mrope && (i == 0 || s.image_spans[i - 1].msg_index != span.msg_index)) {
+            summary = common_tokenize(vocab, imageSummary(s.chat_history, span.msg_index), false, false);
+            summary.resize(std::min(summary.size(), (size_t)std::min(span.p1 - span.p0, (llama_pos)n_batch)));
+        }
+
+        llama_kv_self_seq_rm(lctx, s.seq, span.p0, span.p1);
+        llama_pos freed = 0;
+        if (compact) {
+            freed = span.p1 - span.p0 - (llama_pos)summary.size();
+            llama_kv_self_seq_add(lctx, s.seq, span.p1, -1, -freed);
+        }
+        if (!summary.empty()) {
+            common_batch_clear(batch);
+            for (size_t k = 0; k < summary.size(); k++) {
+                common_batch_add(batch, summary[k], span.p0 + (llama_pos)k, {s.seq}, false);
+            }
+            if (llama_decode(lctx, batch)) {
+                LOGe("Unable to eval image summary");
+                resetConversation(s);
+                return;
+            }
+        }
+        s.n_past -= freed;
+        for (KvMark& mark : s.kv_marks) {
+            if (mark.n_past >= span.p1) {
+                mark.n_past -= freed;
+            }
+        }
+        for (size_t j = i + 1; j < s.image_spans.size(); j++) {
+            s.image_spans[j].p0 -= freed;
+            s.image_spans[j].p1 -= freed;
+        }
+        s.image_spans.erase(s.image_spans.begin() + i);
+        kv_dirty = true;
+        LOGi("Evicted image tokens [%d, %d), %zu summary tokens, now at position %d", span.p0, span.p1,
+             summary.size(), s.n_past);
+    }
+}
+
+bool ModelManager::beginSharedPrompt(int session, const char* prompt) {
+    SessionTurn turn(*this, session);
+    return turn.ok() && beginSharedPrompt(turn.session(), prompt);
+}
+
+bool ModelManager::beginSharedPrompt(Session& s, const char* prompt) {
+    if (!tmpls) {
+        LOGe("Chat templates not initialized");
+        return false;
+    }
+    resetConversation(s);
+
+    // Instruction first, image last, so everything before the marker is shared
+    s.shared_instruction = prompt;
+    s.shared_msg = common_chat_msg();
+    s.shared_msg.role = "user";
+    s.shared_msg.content = std::string(prompt) + "\n<__image__>";
+    std::string full = renderHistory({s.shared_msg}, true);
+    size_t marker = full.find("<__image__>");
+    if (marker == std::string::npos) {
+        LOGe("Chat template dropped the image marker");
         return false;
     }
+    s.shared_prefix = full.substr(0, marker);
+    s.shared_suffix = full.substr(marker);
 
-    n_past = new_n_past;
+    // Same split mtmd_tokenize makes at the marker, so the tokens match a full prompt
+    if (!evalTokens(s, common_tokenize(vocab, s.shared_prefix, true, true))) {
+        LOGe("Unable to eval shared prompt");
+        resetConversation(s);
+        return false;
+    }
+    s.kv_text = s.shared_prefix;
+    s.kv_marks = {{s.kv_text.size(), s.n_past}};
+    s.shared_prefix_n_past = s.n_past;
+    LOGi("Shared prompt prefilled, %d tokens", s.n_past);
     return true;
 }
 
+bool ModelManager::generateSharedPrompt(int session, int max_tokens, TokenCallback callback) {
+    SessionTurn turn(*this, session);
+    if (!turn.ok()) {
+        return false;
+    }
+    Session& s = turn.session();
+    kv_dirty = true;
+    if (s.shared_msg.content.empty()) {
+        LOGe("No shared prompt");
+        return false;
+    }
+    if (s.bitmaps.entries.empty()) {
+        LOGe("No image queued for shared prompt");
+        return false;
+    }
+
+    // Re-prefill if a reset or context overflow dropped the prefix
+    if (s.shared_prefix_n_past < 0) {
+        std::string instruction = s.shared_instruction;
+        if (!beginSharedPrompt(s, instruction.c_str())) {
+            return false;
+        }
+    }
+
+    // Fork from the prefix by dropping the previous item's image, suffix and reply
+    {
+        ModelLock lock(*this);
+        llama_kv_self_seq_rm(lctx, s.seq, s.shared_prefix_n_past, -1);
+    }
+    s.n_past = s.shared_prefix_n_past;
+    s.chat_history.clear();
+    s.image_spans.clear();
+    s.kv_text = s.shared_prefix;
+    s.kv_marks = {{s.kv_text.size(), s.n_past}};
+    s.next_token = LLAMA_TOKEN_NULL;
+    common_sampler_reset(s.sampler);
+
+    std::string suffix = s.shared_suffix;
+    s.expected_tokens = length_predictor.predict(s.shared_instruction.c_str(), true, max_tokens).expected;
+    if (!evalImageDelta(s, s.shared_msg, suffix, true)) {
+        return false;
+    }
+    s.chat_history.push_back(s.shared_msg);
+    s.kv_text += suffix;
+    s.kv_marks.push_back({s.kv_text.size(), s.n_past});
+    return generateTokens(s, max_tokens, callback);
+}
+
+void ModelManager::resetConversation(int session) {
+    SessionTurn turn(*this, session);
+    if (turn.ok()) {
+        resetConversation(turn.session());
+    }
+}
+
+void ModelManager::resetConversation(Session& s) {
+    kv_dirty = true;
+    s.speculation.reset = true;  // nothing left to roll a speculation back to
+    if (s.seq >= 0) {
+        ModelLock lock(*this);
+        llama_kv_self_seq_rm(lctx, s.seq, -1, -1);
+    }
+    clearConversation(s);
+}
+
+// Forgets the session's transcript; its KV cells are the caller's
+void ModelManager::clearConversation(Session& s) {
+    s.shared_prefix_n_past = -1;
+    s.chat_history.clear();
+    s.kv_text.clear();
+    s.kv_marks.clear();
+    s.image_spans.clear();
+    s.n_past = 0;
+    s.next_token = LLAMA_TOKEN_NULL;
+    if (s.sampler) {
+        common_sampler_reset(s.sampler);
+    }
+}
+
+std::vector<common_chat_msg> ModelManager::getChatHistory(int session) {
+    std::shared_ptr<Session> s = findSession(session);
+    if (!s) {
+        return {};
+    }
+    if (s->owner.load() == std::this_thread::get_id()) {
+        return s->chat_history;
+    }
+    std::lock_guard<std::mutex> turn(s->mutex);
+    return s->chat_history;
+}
+
+// Session 0 is created on first use
+std::shared_ptr<ModelManager::Session> ModelManager::findSession(int id) {
+    std::lock_guard<std::mutex> lock(sessions_mutex);
+    auto it = sessions.find(id);
+    if (it != sessions.end()) {
+        return it->second;
+    }
+    if (id != 0) {
+        return nullptr;
+    }
+    std::shared_ptr<Session> s = std::make_shared<Session>();
+    sessions[0] = s;
+    return s;
+}
+
+int ModelManager::createSession() {
+    std::lock_guard<std::mutex> lock(sessions_mutex);
+    std::shared_ptr<Session> s = std::make_shared<Session>();
+    s->id = next_session_id++;
+    sessions[s->id] = s;
+    return s->id;
+}
+
+bool ModelManager::hasSession(int id) {
+    std::lock_guard<std::mutex> lock(sessions_mutex);
+    return id == 0 || sessions.count(id) > 0;
+}
+
+// Waits for a request in progress on the session, so it must not be called
+// from one
+void ModelManager::closeSession(int id) {
+    if (id == 0) {
+        resetConversation(0);
+        return;
+    }
+    std::shared_ptr<Session> s = findSession(id);
+    if (!s) {
+        return;
+    }
+    stopSpeculation(id);
+    {
+        std::lock_guard<std::mutex> turn(s->mutex);
+        ModelLock lock(*this);
+        if (s->seq >= 0) {
+            llama_kv_self_seq_rm(lctx, s->seq, -1, -1);
+            seq_owner[s->seq] = nullptr;
+            s->seq = -1;
+            kv_dirty = true;
+        }
+        session_store.erase(id);
+        std::lock_guard<std::mutex> sessions_lock(sessions_mutex);
+        sessions.erase(id);
+    }
+    scheduler.forget(id);
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    pending_images.erase(id);
+}
+
+// Gives the session a KV sequence, restoring its state if it was swapped
+// out; the caller holds its turn. With every sequence held by a request in
+// progress, waits for one to go idle.
+bool ModelManager::makeResident(Session& s) {
+    for (int attempt = 0;; attempt++) {
+        {
+            ModelLock lock(*this);
+            if (!lctx) {
+                return false;
+            }
+            s.last_use = ++use_counter;
+            if (s.seq >= 0) {
+                return true;
+            }
+            auto freeSequence = [this]() {
+                for (llama_seq_id seq = 0; seq < kMaxSequences; seq++) {
+                    if (!seq_owner[seq]) {
+                        return seq;
+                    }
+                }
+                return (llama_seq_id)-1;
+            };
+            s.seq = freeSequence();
+            if (s.seq < 0 && evictIdleSequence()) {
+                s.seq = freeSequence();
+            }
+            if (s.seq >= 0) {
+                seq_owner[s.seq] = &s;
+                if (s.swapped) {
+                    s.swapped = false;
+                    std::vector<uint8_t> state;
+                    if (!session_store.load(s.id, state) ||
+                        llama_state_seq_set_data(lctx, state.data(), state.size(), s.seq) != state.size()) {
+                        LOGe("Failed to restore session %d, it will start over", s.id);
+                        llama_kv_self_seq_rm(lctx, s.seq, -1, -1);
+                        clearConversation(s);
+                        s.speculation = Speculation();
+                    } else {
+                        LOGi("Restored session %d into sequence %d at position %d", s.id, s.seq, s.n_past);
+                    }
+                }
+                return true;
+            }
+        }
+        // A cancelled request backs off rather than holding up whoever stops it
+        if (s.stopRequested()) {
+            LOGi("Session %d stopped while waiting for a KV sequence", s.id);
+            return false;
+        }
+        if (attempt == 0) {
+            LOGi("All %d KV sequences are in use, session %d waits for one", kMaxSequences, s.id);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+}
+
+// Swaps out the least recently used session that has a sequence but no
+// request in progress; false when there is none. The model is held.
+bool ModelManager::evictIdleSequence() {
+    std::vector<Session*> candidates;
+    for (Session* owner : seq_owner) {
+        if (owner && owner->owner.load() != std::this_thread::get_id()) {
+            candidates.push_back(owner);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Session* a, const Session* b) { return a->last_use < b->last_use; });
+    for (Session* victim : candidates) {
+        if (victim->mutex.try_lock()) {
+            swapOut(*victim);
+            victim->mutex.unlock();
+            return true;
+        }
+    }
+    return false;
+}
+
+// Moves the session's KV state to session_store and frees its sequence; the
+// model and the session are held
+void ModelManager::swapOut(Session& s) {
+    if (s.n_past > 0) {
+        std::vector<uint8_t> state(llama_state_seq_get_size(lctx, s.seq));
+        if (llama_state_seq_get_data(lctx, state.data(), state.size(), s.seq) == state.size() &&
+            session_store.save(s.id, state)) {
+            s.swapped = true;
+        } else {
+            LOGe("Failed to swap out session %d, it will start over", s.id);
+            clearConversation(s);
+            s.speculation = Speculation();
+        }
+    }
+    llama_kv_self_seq_rm(lctx, s.seq, -1, -1);
+    seq_owner[s.seq] = nullptr;
+    LOGi("Swapped out session %d from sequence %d at position %d", s.id, s.seq, s.n_past);
+    s.seq = -1;
+    kv_dirty = true;
+}
+
+std::string ModelManager::renderHistory(const std::vector<common_chat_msg>& msgs, bool add_generation_prompt) const {
+    if (msgs.empty()) {
+        return "";
+    }
+    std::string rendered;
+    if (compiled_tmpl && compiled_tmpl->render(msgs, add_generation_prompt, rendered)) {
+        return rendered;
+    }
+    common_chat_templates_inputs tmpl_inputs;
+    tmpl_inputs.messages = msgs;
+    tmpl_inputs.add_generation_prompt = add_generation_prompt;
+    tmpl_inputs.use_jinja = false;  // legacy templates; jinja is only used to compile compiled_tmpl
+    return common_chat_templates_apply(tmpls.get(), tmpl_inputs).prompt;
+}
+
+// Same idea as common_chat_format_single: render the whole transcript and
+// return only the suffix that is new. The KV cache holds kv_text verbatim
+// (including the raw reply tokens without the turn terminator), so diffing
+// against it also picks up whatever the template appends after a reply.
+std::string ModelManager::formatDelta(Session& s, const common_chat_msg& msg) {
+    std::vector<common_chat_msg> msgs = s.chat_history;
+    msgs.push_back(msg);
+    std::string full = renderHistory(msgs, true);
+
+    if (full.compare(0, s.kv_text.size(), s.kv_text) == 0) {
+        return full.substr(s.kv_text.size());
+    }
+
+    // The template rewrote an earlier turn (e.g. trimmed a reply), so the KV
+    // cache is cut back to the last message boundary before the first
+    // difference and the rest of the transcript is prefilled again
+    size_t common = 0;
+    while (common < s.kv_text.size() && common < full.size() && s.kv_text[common] == full[common]) {
+        common++;
+    }
+    KvMark mark;
+    for (const KvMark& m : s.kv_marks) {
+        if (m.text_size <= common) {
+            mark = m;
+        }
+    }
+
+    // Images in the cut range can't be prefilled again without their bitmaps
+    if (s.kv_text.find("<__image__>", mark.text_size) != std::string::npos) {
+        LOGi("Chat template is not prefix-stable past an image, starting a new conversation");
+        resetConversation(s);
+        return renderHistory({msg}, true);
+    }
+
+    LOGi("Chat template is not prefix-stable, prefilling again from position %d", mark.n_past);
+    if (mark.n_past < s.speculation.n_past) {
+        s.speculation.reset = true;
+    }
+    {
+        ModelLock lock(*this);
+        llama_kv_self_seq_rm(lctx, s.seq, mark.n_past, -1);
+    }
+    s.n_past = mark.n_past;
+    s.next_token = LLAMA_TOKEN_NULL;
+    s.kv_text.resize(mark.text_size);
+    while (!s.kv_marks.empty() && s.kv_marks.back().text_size > mark.text_size) {
+        s.kv_marks.pop_back();
+    }
+    common_sampler_reset(s.sampler);
+    kv_dirty = true;
+    return full.substr(mark.text_size);
+}
+
 bool ModelManager::initializeChatTemplate(const char* template_name) {
     if (!model) {
         LOGe("Model not loaded");
         return false;
     }
+    StartupProfiler::Scope stage(startup_profiler, "chat_template");
 
     // Check if model has built-in chat template
     const char* built_in_template = llama_model_chat_template(model, nullptr);
@@ -241,12 +2034,21 @@ bool ModelManager::initializeChatTemplate(const char* template_name) {
     }
 
     // Initialize chat templates
-    tmpls = common_chat_templates_init(model, template_name);
+    tmpls = common_chat_templates_init(model, template_name ? template_name : "");
     if (!tmpls) {
         LOGe("Failed to initialize chat templates");
         return false;
     }
 
+    // Compile the model's own Jinja template; named overrides are legacy templates
+    compiled_tmpl.reset();
+    if (!template_name) {
+        int64_t t_start_us = ggml_time_us();
+        compiled_tmpl = CompiledChatTemplate::compile(tmpls.get());
+        LOGi("Chat template %s in %lld us", compiled_tmpl ? "compiled" : "not compiled, using legacy templates",
+             (long long)(ggml_time_us() - t_start_us));
+    }
+
     LOGi("Chat template initialized with name: %s", template_name ? template_name : "default");
 
     // Load antiprompt tokens for legacy templates
@@ -260,6 +2062,7 @@ bool ModelManager::initializeChatTemplate(const char* template_name) {
         }
     }
 
+    updateReadiness();
     return true;
 }
 
@@ -9,7 +9,26 @@
 #include "chat.h"
 #include "common.h"
 #include "sampling.h"
+#include "compiled_chat_template.h"
+#include "image_preprocessor.h"
+#include "image_embedding_cache.h"
+#include "prepared_image_cache.h"
+#include "maintenance_scheduler.h"
+#include "resident_pages.h"
+#include "session_store.h"
+#include "decode_pacer.h"
+#include "file_prefetcher.h"
+#include "output_length_predictor.h"
+#include "startup_profiler.h"
+#include "encode_worker.h"
+#include "fair_scheduler.h"
+#include "saliency_tiles.h"
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
 
 #define TAG "com.snap.modelmanager"
 #define LOGi(...) os_log(OS_LOG_DEFAULT, __VA_ARGS__)
@@ -33,48 +52,163 @@ public:
     // Model loading
     bool loadLanguageModel(const char* model_path);
     bool loadVisionModel(const char* mmproj_path);
+    // Model archives (see model_archive.h) stay on disk compressed and are
+    // decoded into this directory on load, reusing a GGUF there that is
+    // newer than its archive. Unset, the GGUF goes next to the archive.
+    void setModelCacheDir(const char* dir) { model_cache_dir = dir; }
     bool initializeContext();
+    // KV cache element type for K and V, applied by the next initializeContext
+    void setKvCacheType(ggml_type type) { kv_type = type; }
     bool initializeBatch();
-    bool initializeSampler();
+    bool initializeSampler(float temperature = 0.2f);
+    // Creates the vision context now rather than on first image use
+    bool initializeVisionContext();
     bool initializeChatTemplate(const char* template_name = nullptr);
 
-    // Image processing
-    bool processImage(const char* image_path);
-    void addBitmap(mtmd::bitmap&& bmp);
-    void clearBitmaps() { bitmaps.entries.clear(); }
-    bool areModelsLoaded() const { return model != nullptr && ctx_vision != nullptr && lctx != nullptr; }
+    // Capabilities usable right now, updated as the load path progresses.
+    // Text replies (always streamed) need the LM, context, batch, sampler and
+    // template; images additionally need the mmproj metadata, and are warm
+    // once the vision context exists.
+    enum Readiness {
+        READY_TEXT = 1 << 0,
+        READY_IMAGE = 1 << 1,
+        READY_IMAGE_WARM = 1 << 2,
+    };
+    int getReadiness() const { return readiness; }
+
+    // Stage timings since the last loadLanguageModel
+    StartupProfiler& getStartupProfiler() { return startup_profiler; }
+
+    // Parallel load: model files are read into the page cache with parallel
+    // large preads before mmap. The mmproj read runs in the background from
+    // loadVisionModel until the vision context is first needed.
+    void setParallelLoad(bool enabled) { parallel_load = enabled; }
+
+    // Image processing. Images are queued for the given session and consumed
+    // by its next prompt. Only a capture (speculate = true) starts a
+    // speculative reply; batch, multi-image and other ingests never do.
+    bool processImage(int session, const char* image_path, bool speculate = false);
+    bool processImageBuffer(int session, const uint8_t* data, size_t size);
+    // Camera and decoded pixels are converted and downscaled in one pass and the
+    // image is encoded in the background right away. With queue = false it is
+    // only pre-encoded for a later prompt.
+    bool processImagePixels(int session, const uint8_t* pixels, int width, int height, int stride, int channels = 4,
+                            bool queue = true, bool speculate = false);
+    // Multi-image prompts: the images are decoded, preprocessed and ranked in
+    // parallel and share max_visual_tokens LM tokens. Each keeps a global view
+    // and the rest of the budget goes to the most salient tiles across all of
+    // them; zero keeps every tile that isn't flat. An image with more salient
+    // tiles than its share gets a lower resolution that its share covers.
+    bool processImages(int session, const char* const* image_paths, int n_images, int max_visual_tokens);
+    // Selective tiling: with a budget of LM tokens and/or encoder ms per image,
+    // tiled images keep their most salient tiles plus a global view and the
+    // rest is dropped (see saliency_tiles.h). Zero for both disables it. The
+    // kept parts are fed as separate images without the projector's tile
+    // markers; the VQA harness's visual_tokens knob measures the cost.
+    void setImageBudget(int max_tokens, float max_ms) { image_budget_tokens = max_tokens; image_budget_ms = max_ms; }
+    // Longest image edge fed to the projector, zero for the projector's own
+    void setMaxImageEdge(int px) { preprocessor.setMaxEdge(px); }
+    void addBitmap(int session, mtmd::bitmap&& bmp);
+    void clearBitmaps(int session);
+    bool areModelsLoaded() const { return model != nullptr && !mmproj_path.empty() && lctx != nullptr; }
 
     // Text generation
     // Callback type for streaming tokens
     using TokenCallback = std::function<void(const std::string& token)>;
     
-    // Modified generateResponse to support streaming
-    bool generateResponse(const char* prompt, int max_tokens, TokenCallback callback);
+    // Modified generateResponse to support streaming; paced replies follow the decode pacing rate
+    bool generateResponse(int session, const char* prompt, int max_tokens, TokenCallback callback, bool paced = false);
     
     // Original generateResponse kept for backward compatibility
-    std::string generateResponse(const char* prompt, int max_tokens);
-    bool evalMessage(const char* prompt, bool add_bos = false);
+    std::string generateResponse(int session, const char* prompt, int max_tokens);
+
+    // Decode pacing for streamed replies, so the UI isn't outrun at full power
+    void setDecodePacing(float tokens_per_second) { decode_rate = tokens_per_second; }
+    // Drops the pacing of the session's reply in progress; safe from any thread
+    void finishResponse(int session);
+
+    // Speculative reply: once an image is captured, the answer to this prompt
+    // about it (the app's default one) is generated in the background on the
+    // image's session, up to max_tokens. Asking exactly that prompt with that
+    // image streams the buffered text and carries on; any other request for
+    // the session drops it and rolls the KV cache back. An empty prompt
+    // disables it.
+    void setSpeculativePrompt(const char* prompt, int max_tokens);
+
+    // Reply length learned from earlier replies to similar prompts
+    OutputLengthPredictor::Prediction predictOutputLength(const char* prompt, bool has_image, int max_tokens) const {
+        return length_predictor.predict(prompt, has_image, max_tokens);
+    }
+
+    // Shared-prefix batching: the instruction is placed before the image and
+    // prefilled once; each image then continues from that cached prefix, so
+    // only the image, the end of the turn and the reply are evaluated per item
+    bool beginSharedPrompt(int session, const char* prompt);
+    bool generateSharedPrompt(int session, int max_tokens, TokenCallback callback);
+    bool evalMessage(int session, const char* prompt, bool add_bos = false);
+
+    // Conversation history
+    void resetConversation(int session);
+    std::vector<common_chat_msg> getChatHistory(int session);
+
+    // Image retention in long conversations: an image's KV cells are dropped
+    // once a new image arrives or max_turns later turns have passed, with the
+    // positions after it compacted. With summarize, the first sentence of the
+    // reply to the image takes its place. Zero turns keeps images.
+    void setImageRetention(int max_turns, bool summarize) {
+        image_retention_turns = max_turns;
+        summarize_images = summarize;
+    }
+
+    // Sessions are independent conversations. Each one in use owns a sequence
+    // of the shared KV cache, so requests from different threads run side by
+    // side and their decode steps are batched together. With more sessions
+    // than sequences, the least recently used idle one is swapped out to
+    // compressed host storage and restored on its next request. Session 0
+    // always exists; closing it only resets it.
+    int createSession();
+    void closeSession(int id);
+    bool hasSession(int id);
+    void setSessionSpillDir(const char* dir) { session_store.setSpillDir(dir); }
+
+    // Fairness between concurrently decoding sessions
+    void setSessionWeight(int id, float weight) { scheduler.setWeight(id, weight); }
+    void setPrefillChunk(int tokens) { scheduler.setPrefillChunk(tokens); }
+    FairScheduler::LatencyStats getTokenLatency(int id) { return scheduler.latency(id); }
 
     // Getters
     mtmd_context* getVisionContext() const { return ctx_vision; }
     llama_context* getLanguageContext() const { return lctx; }
     llama_model* getModel() const { return model; }
     const llama_vocab* getVocab() const { return vocab; }
-    llama_batch& getBatch() { return batch; }
     int getNBatch() const { return n_batch; }
+    // Encoder runs since the models were loaded, cache hits excluded
+    int getEncodeCount() const { return n_encodes; }
+    double getEncodeMs() const { return encode_us / 1000.0; }
+    // LM positions taken by image chunks since the models were loaded
+    int64_t getImageTokens() const { return n_image_tokens; }
     void setNBatch(int batch_size) { n_batch = batch_size; }
-    llama_pos getNPast() const { return n_past; }
-    void setNPast(llama_pos past) { n_past = past; }
-    common_sampler* getSampler() const { return sampler; }
-    mtmd::bitmaps& getBitmaps() { return bitmaps; }
 
 private:
     // Private constructor for singleton
     ModelManager() = default;
     ~ModelManager();
 
-    // Vision context
+    // Vision context, created lazily on first image use
     mtmd_context* ctx_vision = nullptr;
+    std::string mmproj_path;
+    bool ensureVisionContext();
+
+    StartupProfiler startup_profiler;
+    std::atomic<int> readiness{0};
+    void updateReadiness();
+
+    bool parallel_load = false;
+    // Plain GGUF paths pass through; archives resolve to their decoded GGUF
+    // in the model cache
+    std::string resolveModelFile(const char* path);
+    std::string model_cache_dir;
+    FilePrefetcher mmproj_prefetch;
     
     // Language model
     llama_model* model = nullptr;
@@ -82,16 +216,216 @@ private:
     const llama_vocab* vocab = nullptr;
     llama_batch batch;
     int n_batch = 512;  // Default to a larger batch size for better performance
-    llama_pos n_past = 0;
+    ggml_type kv_type = GGML_TYPE_F16;
+    int n_threads = 0;  // the context's defaults, restored after low-power steps
+    int n_threads_batch = 0;
+    bool low_power = false;
     
-    // Sampler
+    // Sampler; each session samples with its own clone
     common_sampler* sampler = nullptr;
+
+    // Idle-time maintenance; foreground requests hold a MaintenanceRequestScope
+    MaintenanceScheduler maintenance;
+    std::string model_path;
+    ResidentPages model_pages;
+    bool touching_weights = false;  // a touch pass is part way through
+    std::atomic<bool> kv_dirty{false};  // KV changed since the last defrag
+    void startMaintenance();
     
     // Image processing
-    mtmd::bitmaps bitmaps;
+    ImagePreprocessor preprocessor;
+    ImageEmbeddingCache image_embeddings;
+    PreparedImageCache prepared_images;
+    std::mutex vision_mutex;  // guards ctx_vision and both image caches
+    int n_encodes = 0;
+    int64_t encode_us = 0;
+    std::atomic<int64_t> n_image_tokens{0};
+    int image_budget_tokens = 0;
+    float image_budget_ms = 0.0f;
+    std::atomic<float> tile_encode_ms{0.0f};  // running encoder cost of one tile
+    int tileBudget(int n_tiles) const;
+    bool ingestBitmap(int session, mtmd::bitmap&& bmp, bool queue, bool speculate);
+    bool splitSalientTiles(mtmd::bitmap& bmp, const std::string& id, std::vector<mtmd::bitmap>& parts);
+    EncodeWorker encoder;  // started on first use
+    std::once_flag encoder_started;
+    void encodeAsync(mtmd::bitmap&& bmp);
+    void preEncode(mtmd::bitmap& bmp);
+    void waitForEncode();
+    const std::vector<float>* encodeImageChunk(const mtmd_input_chunk* chunk);
 
     // Chat template handling
     common_chat_templates_ptr tmpls;
+    std::unique_ptr<CompiledChatTemplate> compiled_tmpl;  // null falls back to the legacy templates
     llama_tokens antiprompt_tokens;
+
+    // Message boundaries in a session's kv_text and the KV position each one starts at
+    struct KvMark {
+        size_t text_size = 0;
+        llama_pos n_past = 0;
+    };
+    // Image chunks in the KV cache, [p0, p1), and the user message they came with
+    struct ImageSpan {
+        llama_pos p0 = 0;
+        llama_pos p1 = 0;
+        size_t msg_index = 0;
+    };
+    int image_retention_turns = 0;
+    bool summarize_images = false;
+
+    // A reply in progress. Generation pauses on stop or the token limit with
+    // the last sampled token not yet decoded, and can be carried on later.
+    struct ReplyState {
+        llama_tokens tokens;  // sampled so far
+        std::string text;
+        llama_token undecoded = LLAMA_TOKEN_NULL;  // streamed, not yet in the KV cache
+        std::string undecoded_piece;
+        bool finished = false;  // end of generation or an antiprompt
+    };
+
+    // Speculative reply, filled by the worker under its own turn and settled
+    // by the next turn of the same session. With reset, the conversation it
+    // would roll back to is gone (a context overflow or a cut by formatDelta),
+    // so dropping it resets the conversation instead.
+    struct Speculation {
+        bool active = false;
+        bool reset = false;
+        std::string prompt;
+        llama_pos n_past = 0;  // conversation before the speculative prompt
+        size_t history_size = 0;
+        size_t kv_text_size = 0;
+        std::vector<ImageSpan> image_spans;
+        std::vector<std::string> image_ids;
+        ReplyState reply;
+    };
+
+    // One conversation. Its fields are only touched by the thread holding its
+    // turn, and by the step leader while that thread waits for a step.
+    struct Session {
+        int id = 0;
+        std::mutex mutex;  // held for a turn
+        std::atomic<std::thread::id> owner{};
+        llama_seq_id seq = -1;  // KV sequence, -1 while not resident
+        bool swapped = false;   // KV state is in session_store
+        uint64_t last_use = 0;
+        common_sampler* sampler = nullptr;
+
+        // The transcript so far and the exact templated text that has been
+        // prefilled into the KV cache for it
+        std::vector<common_chat_msg> chat_history;
+        std::string kv_text;
+        std::vector<KvMark> kv_marks;
+        llama_pos n_past = 0;
+        std::vector<ImageSpan> image_spans;
+        mtmd::bitmaps bitmaps;  // images for the request holding the turn
+        const std::atomic<bool>* stop = nullptr;  // cancels the request holding the turn
+        llama_token next_token = LLAMA_TOKEN_NULL;  // sampled from the logits of the last step
+
+        DecodePacer pacer;
+        // Prefill keeps reserve_tokens free for the reply, so a conversation is
+        // restarted up front rather than running out of context mid-answer
+        int reserve_tokens = 0;
+        int n_generated = 0;
+        int expected_tokens = 0;  // predicted reply tokens still to come, orders steps
+
+        // Shared prompt state; the prefix occupies [0, shared_prefix_n_past)
+        std::string shared_instruction;
+        common_chat_msg shared_msg;
+        std::string shared_prefix;
+        std::string shared_suffix;
+        llama_pos shared_prefix_n_past = -1;
+
+        Speculation speculation;
+
+        bool stopRequested() const { return stop && stop->load(); }
+
+        ~Session() {
+            if (sampler) {
+                common_sampler_free(sampler);
+            }
+        }
+    };
+    std::mutex sessions_mutex;  // guards sessions and next_session_id
+    std::map<int, std::shared_ptr<Session>> sessions;
+    int next_session_id = 1;
+    std::shared_ptr<Session> findSession(int id);
+    void clearConversation(Session& s);
+
+    // Holds a session for one request: swaps it in and hands it the images
+    // queued for it. Nested turns on the holding thread are no-ops.
+    class SessionTurn;
+
+    // KV sequences of the shared cache and the session owning each; guarded
+    // by the model. Idle sessions past kMaxSequences go to session_store.
+    static const int kMaxSequences = 4;
+    Session* seq_owner[kMaxSequences] = {};
+    uint64_t use_counter = 0;
+    SessionStore session_store;
+    bool makeResident(Session& s);
+    bool evictIdleSequence();
+    void swapOut(Session& s);
+
+    // The model (lctx, batch and the KV cache) is used by one thread at a
+    // time: a step leader running a batched decode, or a ModelLock holder
+    // editing the cache. Token steps of all sessions are queued and the
+    // leader decodes them together, split by the fair scheduler.
+    class ModelLock;
+    struct StepWork {
+        Session* session = nullptr;
+        const llama_token* tokens = nullptr;
+        int n_tokens = 0;
+        int n_done = 0;
+        bool decode = false;      // a reply token rather than prefill
+        bool sample = false;      // sample next_token from the last token's logits
+        bool low_power = false;   // the reply is ahead of its pacing
+        bool background = false;  // speculation
+        const std::atomic<bool>* stop = nullptr;
+        bool done = false;
+        bool ok = true;
+    };
+    std::mutex model_mutex;  // guards the fields below
+    std::condition_variable model_cv;
+    bool model_busy = false;
+    std::thread::id model_owner;  // ModelLock holder
+    int model_depth = 0;
+    std::vector<StepWork*> step_queue;
+    FairScheduler scheduler;
+    std::atomic<float> decode_rate{0.0f};
+    bool runStep(Session& s, const llama_token* tokens, int n_tokens, bool decode, bool sample,
+                 bool low_power = false, const std::atomic<bool>* stop = nullptr);
+    void decodeStep(const std::vector<StepWork*>& works);
+    void setLowPower(bool on);
+
+    std::mutex pending_mutex;  // guards pending_images
+    std::map<int, mtmd::bitmaps> pending_images;
+    bool evalMessage(Session& s, const char* prompt, bool add_bos);
+    bool evalTextDelta(Session& s, const common_chat_msg& msg, std::string& delta, bool add_bos);
+    bool evalImageDelta(Session& s, const common_chat_msg& msg, std::string& delta, bool add_bos);
+    bool evalTokens(Session& s, const llama_tokens& tokens);
+    bool generateTokens(Session& s, int max_tokens, TokenCallback callback, bool paced = false);
+    bool prefillPrompt(Session& s, const char* prompt, int max_tokens, bool& has_image);
+    bool runReply(Session& s, ReplyState& reply, int max_tokens, TokenCallback callback, bool paced,
+                  const std::atomic<bool>* stop);
+    void finishReply(Session& s, const ReplyState& reply);
+    bool beginSharedPrompt(Session& s, const char* prompt);
+    void resetConversation(Session& s);
+    std::string renderHistory(const std::vector<common_chat_msg>& msgs, bool add_generation_prompt) const;
+    std::string formatDelta(Session& s, const common_chat_msg& msg);
+    void evictImages(Session& s, bool new_image);
+
+    std::string spec_prompt;
+    int spec_max_tokens = 0;
+    std::mutex spec_mutex;  // guards the fields below
+    std::thread spec_thread;
+    int spec_session = -1;
+    std::vector<std::string> spec_image_ids;
+    std::atomic<bool> spec_stop{false};
+    std::vector<mtmd::bitmap> speculationImages(std::vector<mtmd::bitmap>& parts);
+    void startSpeculation(int session, std::vector<mtmd::bitmap>&& images);
+    void stopSpeculation(int session);  // -1 for any session
+    void speculate(int session, std::string prompt, int max_tokens, std::vector<mtmd::bitmap> images);
+    bool settleSpeculation(Session& s, const char* prompt);
+    void rollbackSpeculation(Session& s);
+
+    OutputLengthPredictor length_predictor;
     bool checkAntiprompt(const llama_tokens& generated_tokens) const;
 };
@@ -1,69 +1,302 @@
 #include "model_manager.h"
+#include "batch_captioner.h"
+#include "gguf_delta.h"
+#include "quant_sweep.h"
+#include "vqa_evaluator.h"
 #include <cstring>
 
 // Callback type for C wrapper
 typedef void (*TokenCallback)(const char* token, void* user_data);
+typedef void (*BatchItemCallback)(int index, int representative, const char* caption, void* user_data);
+
+// What a caller's void* points to: the shared core and the session its
+// requests go to. Callers on different threads or queues each open their
+// own handle, so none of them depends on which thread it runs on.
+struct ManagerHandle {
+    ModelManager* manager;
+    int session;
+};
+
+static ModelManager* managerOf(void* handle) {
+    return static_cast<ManagerHandle*>(handle)->manager;
+}
+
+static int sessionOf(void* handle) {
+    return static_cast<ManagerHandle*>(handle)->session;
+}
 
 extern "C" {
 
+// A handle on session 0
 void* create_model_manager(void) {
-    return &ModelManager::getInstance();
+    return new ManagerHandle{&ModelManager::getInstance(), 0};
 }
 
 void destroy_model_manager(void* manager) {
     if (manager) {
-        static_cast<ModelManager*>(manager)->cleanup();
+        managerOf(manager)->cleanup();
+        delete static_cast<ManagerHandle*>(manager);
+    }
+}
+
+// A handle on a new session of the same core; close with close_session_handle
+void* open_session_handle(void* manager) {
+    if (!manager) return nullptr;
+    ModelManager* core = managerOf(manager);
+    return new ManagerHandle{core, core->createSession()};
+}
+
+void close_session_handle(void* handle) {
+    if (handle) {
+        managerOf(handle)->closeSession(sessionOf(handle));
+        delete static_cast<ManagerHandle*>(handle);
+    }
+}
+
+void set_parallel_load(void* manager, bool enabled) {
+    if (manager) {
+        managerOf(manager)->setParallelLoad(enabled);
+    }
+}
+
+void set_model_cache_dir(void* manager, const char* dir) {
+    if (manager && dir) {
+        managerOf(manager)->setModelCacheDir(dir);
     }
 }
 
+// Patches base_path into a new model version; out_path may be base_path
+bool apply_model_delta(const char* base_path, const char* delta_path, const char* out_path) {
+    return GgufDelta::apply(base_path, delta_path, out_path);
+}
+
 bool load_language_model(void* manager, const char* model_path) {
     if (!manager || !model_path) return false;
-    return static_cast<ModelManager*>(manager)->loadLanguageModel(model_path);
+    return managerOf(manager)->loadLanguageModel(model_path);
 }
 
 bool load_vision_model(void* manager, const char* mmproj_path) {
     if (!manager || !mmproj_path) return false;
-    return static_cast<ModelManager*>(manager)->loadVisionModel(mmproj_path);
+    return managerOf(manager)->loadVisionModel(mmproj_path);
 }
 
 bool initialize_context(void* manager) {
     if (!manager) return false;
-    return static_cast<ModelManager*>(manager)->initializeContext();
+    return managerOf(manager)->initializeContext();
 }
 
 bool initialize_batch(void* manager) {
     if (!manager) return false;
-    return static_cast<ModelManager*>(manager)->initializeBatch();
+    return managerOf(manager)->initializeBatch();
 }
 
 bool initialize_sampler(void* manager) {
     if (!manager) return false;
-    return static_cast<ModelManager*>(manager)->initializeSampler();
+    return managerOf(manager)->initializeSampler();
 }
 
 bool initialize_chat_template(void* manager, const char* template_name) {
     if (!manager) return false;
-    return static_cast<ModelManager*>(manager)->initializeChatTemplate(template_name);
+    return managerOf(manager)->initializeChatTemplate(template_name);
 }
 
 bool process_image(void* manager, const char* image_path) {
     if (!manager || !image_path) return false;
-    return static_cast<ModelManager*>(manager)->processImage(image_path);
+    return managerOf(manager)->processImage(sessionOf(manager), image_path);
+}
+
+bool process_images(void* manager, const char** image_paths, int n_images, int max_visual_tokens) {
+    if (!manager) return false;
+    return managerOf(manager)->processImages(sessionOf(manager), image_paths, n_images, max_visual_tokens);
+}
+
+bool process_image_pixels(void* manager, const unsigned char* pixels, int width, int height, int stride, bool queue,
+                          bool speculate) {
+    if (!manager || !pixels) return false;
+    return managerOf(manager)->processImagePixels(sessionOf(manager), pixels, width, height, stride, 4, queue,
+                                                  speculate);
+}
+
+void set_image_budget(void* manager, int max_tokens, float max_ms) {
+    if (manager) {
+        managerOf(manager)->setImageBudget(max_tokens, max_ms);
+    }
+}
+
+void reset_conversation(void* manager) {
+    if (manager) {
+        managerOf(manager)->resetConversation(sessionOf(manager));
+    }
+}
+
+int create_session(void* manager) {
+    if (!manager) return -1;
+    return managerOf(manager)->createSession();
+}
+
+// Points the handle at another session
+bool switch_session(void* manager, int session_id) {
+    if (!manager || !managerOf(manager)->hasSession(session_id)) return false;
+    static_cast<ManagerHandle*>(manager)->session = session_id;
+    return true;
+}
+
+void close_session(void* manager, int session_id) {
+    if (manager) {
+        managerOf(manager)->closeSession(session_id);
+    }
+}
+
+void set_session_weight(void* manager, int session_id, float weight) {
+    if (manager) {
+        managerOf(manager)->setSessionWeight(session_id, weight);
+    }
+}
+
+int get_token_latency(void* manager, int session_id, float* p50, float* p95, float* p99) {
+    if (!manager) return 0;
+    FairScheduler::LatencyStats stats = managerOf(manager)->getTokenLatency(session_id);
+    if (p50) *p50 = (float)stats.p50_ms;
+    if (p95) *p95 = (float)stats.p95_ms;
+    if (p99) *p99 = (float)stats.p99_ms;
+    return stats.n;
+}
+
+void set_session_spill_dir(void* manager, const char* dir) {
+    if (manager && dir) {
+        managerOf(manager)->setSessionSpillDir(dir);
+    }
 }
 
 bool generate_response_stream(void* manager, const char* prompt, int max_tokens, TokenCallback callback, void* user_data) {
     if (!manager || !prompt || !callback) return false;
     
-    return static_cast<ModelManager*>(manager)->generateResponse(prompt, max_tokens,
+    return managerOf(manager)->generateResponse(sessionOf(manager), prompt, max_tokens,
         [callback, user_data](const std::string& token) {
             callback(token.c_str(), user_data);
+        }, true);  // streamed to a reader, so paced
+}
+
+// Expected and p95 reply length in tokens for a prompt, learned from earlier replies
+bool predict_output_length(void* manager, const char* prompt, bool has_image, int max_tokens, int* expected, int* p95) {
+    if (!manager || !prompt || !expected || !p95) return false;
+    auto prediction = managerOf(manager)->predictOutputLength(prompt, has_image, max_tokens);
+    *expected = prediction.expected;
+    *p95 = prediction.p95;
+    return prediction.n_samples > 0;
+}
+
+void set_decode_pacing(void* manager, float tokens_per_second) {
+    if (manager) {
+        managerOf(manager)->setDecodePacing(tokens_per_second);
+    }
+}
+
+void set_speculative_prompt(void* manager, const char* prompt, int max_tokens) {
+    if (manager) {
+        managerOf(manager)->setSpeculativePrompt(prompt, max_tokens);
+    }
+}
+
+void set_image_retention(void* manager, int max_turns, bool summarize) {
+    if (manager) {
+        managerOf(manager)->setImageRetention(max_turns, summarize);
+    }
+}
+
+void finish_response(void* manager) {
+    if (manager) {
+        managerOf(manager)->finishResponse(sessionOf(manager));
+    }
+}
+
+bool caption_batch(void* manager, const char** image_paths, int n_images, const char* prompt, int max_tokens,
+                   int dedup_threshold, bool shared_prefix, BatchItemCallback callback, void* user_data) {
+    if (!manager || !image_paths || n_images < 0 || !prompt) return false;
+
+    std::vector<std::string> paths(image_paths, image_paths + n_images);
+    BatchCaptioner captioner(*managerOf(manager));
+    captioner.setDedupThreshold(dedup_threshold);
+    captioner.setSharedPrefix(shared_prefix);
+    BatchCaptioner::Result result;
+    return captioner.run(paths, prompt, max_tokens, result,
+        [callback, user_data](size_t index, size_t representative, const std::string& caption) {
+            if (callback) {
+                callback((int)index, (int)representative, caption.c_str(), user_data);
+            }
         });
 }
 
+// Runs the VQA set under each configuration and writes a CSV report. The
+// knob arrays may each be null for the defaults. The caller reloads its own
+// models and settings afterwards.
+bool run_vqa_eval(void* manager, const char* set_path, const char** names, const char** lm_paths,
+                  const char** mmproj_paths, const int* visual_tokens, const int* max_image_edges,
+                  const int* kv_types, const int* speculative_think_ms, int n_configs, int max_tokens,
+                  const char* report_path) {
+    if (!manager || !set_path || !names || !lm_paths || !mmproj_paths || n_configs <= 0 || !report_path) return false;
+
+    VqaEvaluator evaluator(*managerOf(manager));
+    if (!evaluator.loadSet(set_path)) {
+        return false;
+    }
+    std::vector<VqaEvaluator::Config> configs(n_configs);
+    for (int i = 0; i < n_configs; i++) {
+        configs[i].name = names[i];
+        configs[i].lm_path = lm_paths[i];
+        configs[i].mmproj_path = mmproj_paths[i];
+        configs[i].max_tokens = max_tokens;
+        configs[i].visual_tokens = visual_tokens ? visual_tokens[i] : 0;
+        configs[i].max_image_edge = max_image_edges ? max_image_edges[i] : 0;
+        configs[i].kv_type = kv_types ? (ggml_type)kv_types[i] : GGML_TYPE_F16;
+        configs[i].speculative_think_ms = speculative_think_ms ? speculative_think_ms[i] : 0;
+    }
+    std::vector<VqaEvaluator::Report> reports;
+    return evaluator.run(configs, reports) && VqaEvaluator::writeReport(reports, report_path);
+}
+
+// Quantizes an F16 pair into out_dir, benchmarks every LM/mmproj combination
+// on the fixed prompts and writes a CSV report
+bool run_quant_sweep(void* manager, const char* lm_f16_path, const char* mmproj_f16_path, const char* out_dir,
+                     const char** image_paths, const char** prompts, int n_prompts, int max_tokens,
+                     const char* report_path) {
+    if (!manager || !lm_f16_path || !mmproj_f16_path || !out_dir || !image_paths || !prompts || n_prompts <= 0 ||
+        !report_path) return false;
+
+    QuantSweep sweep(*managerOf(manager));
+    if (!sweep.prepare(lm_f16_path, mmproj_f16_path, out_dir)) {
+        return false;
+    }
+    std::vector<QuantSweep::Prompt> fixed(n_prompts);
+    for (int i = 0; i < n_prompts; i++) {
+        fixed[i] = {image_paths[i], prompts[i]};
+    }
+    std::vector<QuantSweep::Result> results;
+    return sweep.run(fixed, max_tokens, results) && QuantSweep::writeReport(results, report_path);
+}
+
+// Bit flags: 1 text, 2 image, 4 image encoder warm
+int get_readiness(void* manager) {
+    if (!manager) return 0;
+    return managerOf(manager)->getReadiness();
+}
+
+// One "stage start_ms duration_ms" line per load stage; free with free_response
+char* get_startup_profile(void* manager) {
+    if (!manager) return nullptr;
+
+    std::string report = managerOf(manager)->getStartupProfiler().report();
+    char* result = static_cast<char*>(malloc(report.length() + 1));
+    if (result) {
+        strcpy(result, report.c_str());
+    }
+    return result;
+}
+
 char* generate_response(void* manager, const char* prompt, int max_tokens) {
     if (!manager || !prompt) return nullptr;
     
-    std::string response = static_cast<ModelManager*>(manager)->generateResponse(prompt, max_tokens);
+    std::string response = managerOf(manager)->generateResponse(sessionOf(manager), prompt, max_tokens);
     char* result = static_cast<char*>(malloc(response.length() + 1));
     if (result) {
         strcpy(result, response.c_str());
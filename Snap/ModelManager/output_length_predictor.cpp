@@ -0,0 +1,90 @@
+#include "output_length_predictor.h"
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+const size_t kWindow = 32;
+const size_t kMinSamples = 4;
+const size_t kMaxClasses = 256;
+
+}  // namespace
+
+// FNV-1a over the lowercased prompt with runs of whitespace and trailing
+// punctuation dropped, so "Describe this image." and "describe  this image"
+// share a class
+uint64_t OutputLengthPredictor::classKey(const std::string& prompt, bool has_image) {
+    std::string norm;
+    for (char c : prompt) {
+        if (std::isspace((unsigned char)c)) {
+            if (!norm.empty() && norm.back() != ' ') {
+                norm += ' ';
+            }
+        } else {
+            norm += (char)std::tolower((unsigned char)c);
+        }
+    }
+    while (!norm.empty() && (norm.back() == ' ' || std::ispunct((unsigned char)norm.back()))) {
+        norm.pop_back();
+    }
+    uint64_t hash = 1469598103934665603ull ^ (has_image ? 1 : 0);
+    for (char c : norm) {
+        hash = (hash ^ (uint8_t)c) * 1099511628211ull;
+    }
+    return hash;
+}
+
+void OutputLengthPredictor::add(History& history, int n_tokens) {
+    if (history.lengths.size() < kWindow) {
+        history.lengths.push_back(n_tokens);
+    } else {
+        history.lengths[history.next] = n_tokens;
+        history.next = (history.next + 1) % kWindow;
+    }
+}
+
+OutputLengthPredictor::Prediction OutputLengthPredictor::summarize(const History& history, int max_tokens) {
+    std::vector<int> sorted = history.lengths;
+    std::sort(sorted.begin(), sorted.end());
+    long sum = 0;
+    for (int n : sorted) {
+        sum += n;
+    }
+    int n = (int)sorted.size();
+    int p95 = sorted[std::min(n - 1, (n * 95 + 99) / 100 - 1)];
+    return {std::min(max_tokens, (int)(sum / n)), std::min(max_tokens, p95), n};
+}
+
+OutputLengthPredictor::Prediction OutputLengthPredictor::predict(const std::string& prompt, bool has_image,
+                                                                 int max_tokens) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = classes.find(classKey(prompt, has_image));
+    if (it != classes.end() && it->second.lengths.size() >= kMinSamples) {
+        return summarize(it->second, max_tokens);
+    }
+    const History& fallback = modality[has_image ? 1 : 0];
+    if (fallback.lengths.size() >= kMinSamples) {
+        return summarize(fallback, max_tokens);
+    }
+    return {max_tokens, max_tokens, 0};
+}
+
+void OutputLengthPredictor::record(const std::string& prompt, bool has_image, int n_tokens) {
+    std::lock_guard<std::mutex> lock(mutex);
+    History& history = classes[classKey(prompt, has_image)];
+    history.last_use = ++use_counter;
+    add(history, n_tokens);
+    add(modality[has_image ? 1 : 0], n_tokens);
+
+    if (classes.size() > kMaxClasses) {
+        auto oldest = std::min_element(classes.begin(), classes.end(), [](const auto& a, const auto& b) {
+            return a.second.last_use < b.second.last_use;
+        });
+        classes.erase(oldest);
+    }
+}
+
+void OutputLengthPredictor::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    classes.clear();
+}
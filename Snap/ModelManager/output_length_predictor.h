@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Predicts how many tokens a reply will take, learned online from finished
+// replies. Prompts are grouped into classes by their normalized text and
+// whether an image is attached; a class with too few samples of its own
+// falls back to everything seen with the same modality. Safe to call from
+// several threads.
+class OutputLengthPredictor {
+public:
+    struct Prediction {
+        int expected;   // mean of recent replies
+        int p95;        // safe reservation
+        int n_samples;  // zero when nothing was known and max_tokens was returned
+    };
+
+    Prediction predict(const std::string& prompt, bool has_image, int max_tokens) const;
+    void record(const std::string& prompt, bool has_image, int n_tokens);
+    void clear();
+
+private:
+    struct History {
+        std::vector<int> lengths;  // ring of the most recent replies
+        size_t next = 0;
+        uint64_t last_use = 0;
+    };
+
+    static uint64_t classKey(const std::string& prompt, bool has_image);
+    static void add(History& history, int n_tokens);
+    static Prediction summarize(const History& history, int max_tokens);
+
+    mutable std::mutex mutex;  // guards the fields below
+    std::map<uint64_t, History> classes;
+    History modality[2];
+    uint64_t use_counter = 0;
+};
@@ -0,0 +1,77 @@
+#include "perceptual_hash.h"
+#include <cstddef>
+#include <vector>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+constexpr int kGridW = 9;
+constexpr int kGridH = 8;
+
+// BT.601 luma in 8.8 fixed point, one row at a time
+void lumaRow(const uint8_t* row, int width, int channels, uint16_t* luma) {
+    int x = 0;
+#if defined(__ARM_NEON)
+    const uint8x8_t wr = vdup_n_u8(77), wg = vdup_n_u8(150), wb = vdup_n_u8(29);
+    for (; x + 8 <= width; x += 8) {
+        uint8x8_t r, g, b;
+        if (channels == 4) {
+            uint8x8x4_t px = vld4_u8(row + x * 4);
+            r = px.val[0]; g = px.val[1]; b = px.val[2];
+        } else {
+            uint8x8x3_t px = vld3_u8(row + x * 3);
+            r = px.val[0]; g = px.val[1]; b = px.val[2];
+        }
+        uint16x8_t y = vmull_u8(r, wr);
+        y = vmlal_u8(y, g, wg);
+        y = vmlal_u8(y, b, wb);
+        vst1q_u16(luma + x, vshrq_n_u16(y, 8));
+    }
+#endif
+    for (; x < width; x++) {
+        const uint8_t* px = row + x * channels;
+        luma[x] = (uint16_t)((px[0] * 77 + px[1] * 150 + px[2] * 29) >> 8);
+    }
+}
+
+} // namespace
+
+uint64_t perceptualHash(const uint8_t* pixels, int width, int height, int stride, int channels) {
+    if (!pixels || width < kGridW || height < kGridH || (channels != 3 && channels != 4)) {
+        return 0;
+    }
+
+    std::vector<uint16_t> luma(width);
+    uint64_t sums[kGridH][kGridW] = {};
+    int col_edge[kGridW + 1];
+    for (int gx = 0; gx <= kGridW; gx++) {
+        col_edge[gx] = (int)((int64_t)gx * width / kGridW);
+    }
+
+    for (int y = 0; y < height; y++) {
+        lumaRow(pixels + (size_t)y * stride, width, channels, luma.data());
+        int gy = (int)((int64_t)y * kGridH / height);
+        for (int gx = 0; gx < kGridW; gx++) {
+            uint32_t sum = 0;
+            for (int x = col_edge[gx]; x < col_edge[gx + 1]; x++) {
+                sum += luma[x];
+            }
+            sums[gy][gx] += sum;
+        }
+    }
+
+    // Cells within a row cover the same area up to one column, so compare
+    // means rather than raw sums
+    uint64_t hash = 0;
+    for (int gy = 0; gy < kGridH; gy++) {
+        for (int gx = 0; gx < kGridW - 1; gx++) {
+            uint64_t left = sums[gy][gx] * (uint64_t)(col_edge[gx + 2] - col_edge[gx + 1]);
+            uint64_t right = sums[gy][gx + 1] * (uint64_t)(col_edge[gx + 1] - col_edge[gx]);
+            hash = (hash << 1) | (left > right ? 1 : 0);
+        }
+    }
+    return hash;
+}
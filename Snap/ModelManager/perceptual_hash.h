@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+
+// 64-bit difference hash: the image is reduced to a 9x8 luma grid by area
+// averaging and each bit records whether a cell is brighter than its right
+// neighbour. Near-identical shots (bursts, re-encodes, small shifts) land
+// within a few bits of each other.
+uint64_t perceptualHash(const uint8_t* pixels, int width, int height, int stride, int channels);
+
+inline int hashDistance(uint64_t a, uint64_t b) {
+    return __builtin_popcountll(a ^ b);
+}
@@ -0,0 +1,29 @@
+#include "prepared_image_cache.h"
+
+bool PreparedImageCache::contains(const std::string& id) const {
+    for (const auto& entry : entries) {
+        if (entry.first == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PreparedImageCache::put(const std::string& id, mtmd::input_chunks_ptr&& chunks) {
+    take(id);
+    entries.emplace_front(id, std::move(chunks));
+    while (entries.size() > capacity) {
+        entries.pop_back();
+    }
+}
+
+mtmd::input_chunks_ptr PreparedImageCache::take(const std::string& id) {
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it->first == id) {
+            mtmd::input_chunks_ptr chunks = std::move(it->second);
+            entries.erase(it);
+            return chunks;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <algorithm>
+#include <list>
+#include <string>
+#include <utility>
+#include "mtmd.h"
+
+// Chunks tokenized for pre-encoding, held until the prompt that consumes the
+// image is prefilled. mtmd_tokenize runs the projector's preprocessing
+// (resize, tiling, normalization) for every bitmap it is given, so reusing
+// these keeps that work to once per image. Entries are taken, not copied,
+// as they hold the preprocessed pixels.
+class PreparedImageCache {
+public:
+    explicit PreparedImageCache(size_t capacity = 4) : capacity(capacity) {}
+
+    bool contains(const std::string& id) const;
+    void put(const std::string& id, mtmd::input_chunks_ptr&& chunks);
+    // Removes and returns the entry, null when there is none
+    mtmd::input_chunks_ptr take(const std::string& id);
+    void clear() { entries.clear(); }
+
+    // Never shrinks; an image split into tiles needs an entry per tile
+    void ensureCapacity(size_t n) { capacity = std::max(capacity, n); }
+
+private:
+    size_t capacity;
+    std::list<std::pair<std::string, mtmd::input_chunks_ptr>> entries;  // most recent first
+};
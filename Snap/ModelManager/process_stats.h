@@ -0,0 +1,21 @@
+#pragma once
+
+#include <mach/mach.h>
+#include <sys/resource.h>
+
+// Physical footprint of the process, the figure iOS applies memory limits to
+inline double physFootprintMb() {
+    task_vm_info_data_t info;
+    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+        return 0.0;
+    }
+    return info.phys_footprint / 1048576.0;
+}
+
+// User plus system CPU time of the process
+inline double cpuSeconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
@@ -0,0 +1,203 @@
+#include "quant_sweep.h"
+#include "model_manager.h"
+#include "process_stats.h"
+#include "clip.h"
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <sstream>
+#include <sys/stat.h>
+
+namespace {
+
+struct QuantType {
+    const char* name;
+    llama_ftype lm_ftype;
+    ggml_type mmproj_type;
+};
+
+const QuantType kTypes[] = {
+    {"Q8_0", LLAMA_FTYPE_MOSTLY_Q8_0, GGML_TYPE_Q8_0},
+    {"Q6_K", LLAMA_FTYPE_MOSTLY_Q6_K, GGML_TYPE_Q6_K},
+    {"Q5_K", LLAMA_FTYPE_MOSTLY_Q5_K_M, GGML_TYPE_Q5_K},
+    {"Q4_K", LLAMA_FTYPE_MOSTLY_Q4_K_M, GGML_TYPE_Q4_K},
+    {"Q4_0", LLAMA_FTYPE_MOSTLY_Q4_0, GGML_TYPE_Q4_0},
+};
+
+double fileMb(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size / 1048576.0 : 0.0;
+}
+
+// "dir/name.gguf" for "/path/name-F16.gguf" and "Q4_K" becomes "dir/name-Q4_K.gguf"
+std::string variantPath(const std::string& src, const std::string& dir, const char* type) {
+    std::string stem = src.substr(src.find_last_of('/') + 1);
+    stem = stem.substr(0, stem.rfind(".gguf"));
+    for (const char* suffix : {"-F16", "-f16"}) {
+        if (stem.size() > 4 && stem.compare(stem.size() - 4, 4, suffix) == 0) {
+            stem.resize(stem.size() - 4);
+        }
+    }
+    return dir + "/" + stem + "-" + type + ".gguf";
+}
+
+}  // namespace
+
+bool QuantSweep::prepare(const char* lm_f16_path, const char* mmproj_f16_path, const char* out_dir) {
+    variants.clear();
+    variants.push_back({"F16", lm_f16_path, mmproj_f16_path});
+    for (const QuantType& type : kTypes) {
+        Variant variant = {type.name, variantPath(lm_f16_path, out_dir, type.name),
+                           variantPath(mmproj_f16_path, out_dir, type.name)};
+        if (fileMb(variant.lm_path) == 0.0) {
+            int64_t t_start_us = ggml_time_us();
+            llama_model_quantize_params params = llama_model_quantize_default_params();
+            params.ftype = type.lm_ftype;
+            if (llama_model_quantize(lm_f16_path, variant.lm_path.c_str(), &params) != 0) {
+                LOGe("Failed to quantize %s to %s", lm_f16_path, type.name);
+                return false;
+            }
+            LOGi("Quantized LM to %s in %lld ms", type.name, (long long)(ggml_time_us() - t_start_us) / 1000);
+        }
+        if (fileMb(variant.mmproj_path) == 0.0) {
+            int64_t t_start_us = ggml_time_us();
+            if (!clip_model_quantize(mmproj_f16_path, variant.mmproj_path.c_str(), type.mmproj_type)) {
+                LOGe("Failed to quantize %s to %s", mmproj_f16_path, type.name);
+                return false;
+            }
+            LOGi("Quantized mmproj to %s in %lld ms", type.name, (long long)(ggml_time_us() - t_start_us) / 1000);
+        }
+        variants.push_back(std::move(variant));
+    }
+    return true;
+}
+
+double QuantSweep::wordF1(const std::string& reply, const std::string& reference) {
+    auto words = [](const std::string& text) {
+        std::map<std::string, int> counts;
+        std::istringstream stream(text);
+        std::string word;
+        while (stream >> word) {
+            counts[word]++;
+        }
+        return counts;
+    };
+    std::map<std::string, int> a = words(reply);
+    std::map<std::string, int> b = words(reference);
+    int n_a = 0, n_b = 0, common = 0;
+    for (const auto& [word, n] : a) {
+        n_a += n;
+        auto it = b.find(word);
+        common += it == b.end() ? 0 : std::min(n, it->second);
+    }
+    for (const auto& [word, n] : b) {
+        n_b += n;
+    }
+    if (n_a == 0 || n_b == 0) {
+        return n_a == n_b ? 1.0 : 0.0;
+    }
+    double precision = (double)common / n_a;
+    double recall = (double)common / n_b;
+    return common == 0 ? 0.0 : 2 * precision * recall / (precision + recall);
+}
+
+bool QuantSweep::runPair(const Variant& lm, const Variant& mmproj, const std::vector<Prompt>& prompts,
+                         int max_tokens, Result& result, std::vector<std::string>& replies) {
+    result = Result();
+    result.lm = lm.name;
+    result.mmproj = mmproj.name;
+    result.lm_mb = fileMb(lm.lm_path);
+    result.mmproj_mb = fileMb(mmproj.mmproj_path);
+
+    int64_t t_start_us = ggml_time_us();
+    if (!manager.loadLanguageModel(lm.lm_path.c_str()) || !manager.loadVisionModel(mmproj.mmproj_path.c_str()) ||
+        !manager.initializeContext() || !manager.initializeBatch() || !manager.initializeSampler(0.0f) ||
+        !manager.initializeChatTemplate() || !manager.initializeVisionContext()) {
+        LOGe("Failed to load LM %s with mmproj %s", lm.name.c_str(), mmproj.name.c_str());
+        return false;
+    }
+    result.load_ms = (ggml_time_us() - t_start_us) / 1000.0;
+    result.resident_mb = physFootprintMb();
+    result.peak_mb = result.resident_mb;
+
+    double prefill_ms = 0.0, decode_ms = 0.0;
+    long n_prefill = 0, n_decode = 0;
+    replies.clear();
+    for (const Prompt& prompt : prompts) {
+        manager.resetConversation(0);
+        std::string reply;
+        llama_perf_context_reset(manager.getLanguageContext());
+        bool ok = manager.processImage(0, prompt.image_path.c_str()) &&
+                  manager.generateResponse(0, prompt.text.c_str(), max_tokens,
+                      [&](const std::string& token) {
+                          reply += token;
+                          result.peak_mb = std::max(result.peak_mb, physFootprintMb());
+                      }, false);
+        if (!ok) {
+            LOGe("Prompt failed for LM %s with mmproj %s", lm.name.c_str(), mmproj.name.c_str());
+        }
+        llama_perf_context_data perf = llama_perf_context(manager.getLanguageContext());
+        prefill_ms += perf.t_p_eval_ms;
+        n_prefill += perf.n_p_eval;
+        decode_ms += perf.t_eval_ms;
+        n_decode += perf.n_eval;
+        replies.push_back(reply);
+    }
+    manager.resetConversation(0);
+
+    result.encode_ms = manager.getEncodeCount() > 0 ? manager.getEncodeMs() / manager.getEncodeCount() : 0.0;
+    result.prefill_tps = prefill_ms > 0 ? n_prefill * 1000.0 / prefill_ms : 0.0;
+    result.decode_tps = decode_ms > 0 ? n_decode * 1000.0 / decode_ms : 0.0;
+    return true;
+}
+
+bool QuantSweep::run(const std::vector<Prompt>& prompts, int max_tokens, std::vector<Result>& results) {
+    results.clear();
+    if (variants.empty() || prompts.empty()) {
+        return false;
+    }
+
+    std::vector<std::string> reference;
+    for (const Variant& lm : variants) {
+        for (const Variant& mmproj : variants) {
+            Result result;
+            std::vector<std::string> replies;
+            if (!runPair(lm, mmproj, prompts, max_tokens, result, replies)) {
+                if (reference.empty()) {
+                    return false;  // no F16 baseline to score against
+                }
+                continue;
+            }
+            if (reference.empty()) {
+                reference = replies;
+            }
+            for (size_t i = 0; i < prompts.size(); i++) {
+                result.agreement += wordF1(replies[i], reference[i]) / prompts.size();
+                result.exact += replies[i] == reference[i] ? 1.0 / prompts.size() : 0.0;
+            }
+            LOGi("Sweep LM %s + mmproj %s: %.0f MB, load %.0f ms, resident %.0f MB, encode %.0f ms, "
+                 "prefill %.0f t/s, decode %.1f t/s, agreement %.3f",
+                 result.lm.c_str(), result.mmproj.c_str(), result.lm_mb + result.mmproj_mb, result.load_ms,
+                 result.resident_mb, result.encode_ms, result.prefill_tps, result.decode_tps, result.agreement);
+            results.push_back(result);
+        }
+    }
+    return true;
+}
+
+bool QuantSweep::writeReport(const std::vector<Result>& results, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        LOGe("Failed to write sweep report to %s", path);
+        return false;
+    }
+    fprintf(file, "lm,mmproj,lm_mb,mmproj_mb,load_ms,resident_mb,peak_mb,encode_ms,prefill_tps,decode_tps,"
+                  "agreement,exact\n");
+    for (const Result& r : results) {
+        fprintf(file, "%s,%s,%.1f,%.1f,%.0f,%.1f,%.1f,%.1f,%.1f,%.2f,%.4f,%.4f\n", r.lm.c_str(), r.mmproj.c_str(),
+                r.lm_mb, r.mmproj_mb, r.load_ms, r.resident_mb, r.peak_mb, r.encode_ms, r.prefill_tps,
+                r.decode_tps, r.agreement, r.exact);
+    }
+    fclose(file);
+    return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+class ModelManager;
+
+// Quantization sweep over an F16 model pair. prepare() writes Q8_0, Q6_K,
+// Q5_K, Q4_K and Q4_0 variants of the LM and the mmproj; run() loads every
+// LM/mmproj combination, F16 included, and answers fixed image prompts with
+// greedy sampling in session 0. Replies are scored against the F16/F16 pair. Like the
+// VQA harness, the caller reloads its own models afterwards.
+class QuantSweep {
+public:
+    struct Prompt {
+        std::string image_path;
+        std::string text;
+    };
+
+    struct Result {
+        std::string lm;
+        std::string mmproj;
+        double lm_mb = 0.0;         // file sizes
+        double mmproj_mb = 0.0;
+        double load_ms = 0.0;       // both models, contexts included
+        double resident_mb = 0.0;   // footprint once loaded
+        double peak_mb = 0.0;       // footprint peak while answering
+        double encode_ms = 0.0;     // mean per image
+        double prefill_tps = 0.0;
+        double decode_tps = 0.0;
+        double agreement = 0.0;     // mean word-level F1 against F16/F16
+        double exact = 0.0;         // fraction of replies identical to F16/F16
+    };
+
+    explicit QuantSweep(ModelManager& manager) : manager(manager) {}
+
+    // Existing variant files in out_dir are reused
+    bool prepare(const char* lm_f16_path, const char* mmproj_f16_path, const char* out_dir);
+    bool run(const std::vector<Prompt>& prompts, int max_tokens, std::vector<Result>& results);
+
+    // CSV, one row per combination
+    static bool writeReport(const std::vector<Result>& results, const char* path);
+
+private:
+    struct Variant {
+        std::string name;
+        std::string lm_path;
+        std::string mmproj_path;
+    };
+
+    bool runPair(const Variant& lm, const Variant& mmproj, const std::vector<Prompt>& prompts, int max_tokens,
+                 Result& result, std::vector<std::string>& replies);
+    static double wordF1(const std::string& reply, const std::string& reference);
+
+    ModelManager& manager;
+    std::vector<Variant> variants;  // F16 first
+};
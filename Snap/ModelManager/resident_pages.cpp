@@ -0,0 +1,99 @@
+#include "resident_pages.h"
+#include "model_manager.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool ResidentPages::open(const char* path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        LOGe("Failed to open %s for paging", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        LOGe("Failed to map %s for paging", path);
+        return false;
+    }
+    addr = static_cast<uint8_t*>(mapped);
+    size = (size_t)st.st_size;
+    offset = 0;
+    return true;
+}
+
+void ResidentPages::close() {
+    if (addr) {
+        munmap(addr, size);
+        addr = nullptr;
+    }
+    size = 0;
+    offset = 0;
+}
+
+bool ResidentPages::residency(size_t begin, size_t end, std::vector<uint8_t>& resident) const {
+    const size_t page = (size_t)getpagesize();
+    resident.resize((end - begin + page - 1) / page);
+#if defined(__APPLE__)
+    if (mincore(addr + begin, end - begin, reinterpret_cast<char*>(resident.data())) != 0) {
+#else
+    if (mincore(addr + begin, end - begin, resident.data()) != 0) {
+#endif
+        return false;
+    }
+    for (uint8_t& r : resident) {
+        r &= 1;
+    }
+    return true;
+}
+
+bool ResidentPages::hasEvicted() const {
+    if (!addr) {
+        return false;
+    }
+    std::vector<uint8_t> resident;
+    if (!residency(0, size, resident)) {
+        return true;
+    }
+    return std::find(resident.begin(), resident.end(), 0) != resident.end();
+}
+
+bool ResidentPages::touchNext(size_t window_bytes) {
+    if (!addr) {
+        return false;
+    }
+    const size_t page = (size_t)getpagesize();
+    size_t begin = offset - offset % page;
+    size_t end = std::min(size, offset + window_bytes);
+    std::vector<uint8_t> resident;
+    if (!residency(begin, end, resident)) {
+        resident.assign((end - begin + page - 1) / page, 0);
+    }
+
+    // Reading one byte per page is what actually faults evicted pages back in
+    if (std::find(resident.begin(), resident.end(), 0) != resident.end()) {
+        madvise(addr + begin, end - begin, MADV_WILLNEED);
+        volatile uint8_t sink = 0;
+        for (size_t pos = begin, i = 0; pos < end; pos += page, i++) {
+            if (!resident[i]) {
+                sink = sink ^ addr[pos];
+            }
+        }
+        (void)sink;
+    }
+
+    offset = end;
+    if (offset >= size) {
+        offset = 0;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Read-only mapping of a model file whose evicted pages are touched in
+// bounded windows, so weights dropped under memory pressure are faulted back
+// in while the core is idle rather than during the next request. Residency
+// is checked with mincore first, so pages still in memory are never read.
+// The mapping shares the page cache with llama.cpp's own mmap of the file.
+class ResidentPages {
+public:
+    ResidentPages() = default;
+    ResidentPages(const ResidentPages&) = delete;
+    ResidentPages& operator=(const ResidentPages&) = delete;
+    ~ResidentPages() { close(); }
+
+    bool open(const char* path);
+    void close();
+
+    // True when some pages of the file are no longer resident
+    bool hasEvicted() const;
+
+    // Touches the evicted pages of the next window_bytes; returns true until
+    // a full pass completes
+    bool touchNext(size_t window_bytes);
+
+private:
+    // Residency of each page in [begin, end), false when mincore fails
+    bool residency(size_t begin, size_t end, std::vector<uint8_t>& resident) const;
+
+    uint8_t* addr = nullptr;
+    size_t size = 0;
+    size_t offset = 0;
+};
@@ -0,0 +1,188 @@
+#include "saliency_tiles.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+constexpr int kScale = 4;         // thumbnail is a quarter of each side
+constexpr int kEdgeThreshold = 24;  // luma step counted as an edge
+
+// BT.601 luma of one RGB row, summed over horizontal groups of kScale pixels
+void accumulateLumaRow(const uint8_t* row, int width, uint32_t* acc) {
+    int x = 0;
+#if defined(__ARM_NEON)
+    const uint8x8_t wr = vdup_n_u8(77), wg = vdup_n_u8(150), wb = vdup_n_u8(29);
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x3_t px = vld3q_u8(row + x * 3);
+        uint16x8_t lo = vmull_u8(vget_low_u8(px.val[0]), wr);
+        lo = vmlal_u8(lo, vget_low_u8(px.val[1]), wg);
+        lo = vmlal_u8(lo, vget_low_u8(px.val[2]), wb);
+        uint16x8_t hi = vmull_u8(vget_high_u8(px.val[0]), wr);
+        hi = vmlal_u8(hi, vget_high_u8(px.val[1]), wg);
+        hi = vmlal_u8(hi, vget_high_u8(px.val[2]), wb);
+        lo = vshrq_n_u16(lo, 8);
+        hi = vshrq_n_u16(hi, 8);
+
+        // Pairwise adds fold 16 lumas into the 4 groups they belong to
+        uint32x4_t groups = vpaddq_u32(vpaddlq_u16(lo), vpaddlq_u16(hi));
+        uint32_t* a = acc + x / kScale;
+        vst1q_u32(a, vaddq_u32(vld1q_u32(a), groups));
+    }
+#endif
+    for (; x < width; x++) {
+        const uint8_t* px = row + x * 3;
+        acc[x / kScale] += (uint32_t)((px[0] * 77 + px[1] * 150 + px[2] * 29) >> 8);
+    }
+}
+
+struct EdgeCounts {
+    int strong = 0;      // pixels with a horizontal or vertical step
+    int horizontal = 0;  // pixels with a horizontal step
+};
+
+// Edge counts along n thumbnail pixels; p[1] and p[stride] must be readable
+EdgeCounts countEdges(const uint8_t* p, int n, int stride) {
+    EdgeCounts counts;
+    int x = 0;
+#if defined(__ARM_NEON)
+    const uint8x16_t threshold = vdupq_n_u8(kEdgeThreshold);
+    while (x + 16 <= n) {
+        // Lane counters stay within u8 for up to 255 vectors
+        uint8x16_t strong = vdupq_n_u8(0);
+        uint8x16_t horizontal = vdupq_n_u8(0);
+        for (int i = 0; i < 255 && x + 16 <= n; i++, x += 16) {
+            uint8x16_t c = vld1q_u8(p + x);
+            uint8x16_t dx = vabdq_u8(c, vld1q_u8(p + x + 1));
+            uint8x16_t dy = vabdq_u8(c, vld1q_u8(p + x + stride));
+            uint8x16_t h = vcgtq_u8(dx, threshold);
+            uint8x16_t s = vcgtq_u8(vmaxq_u8(dx, dy), threshold);
+            horizontal = vsubq_u8(horizontal, h);  // masks are 0xff, i.e. -1
+            strong = vsubq_u8(strong, s);
+        }
+        counts.strong += vaddlvq_u8(strong);
+        counts.horizontal += vaddlvq_u8(horizontal);
+    }
+#endif
+    for (; x < n; x++) {
+        int dx = std::abs(p[x] - p[x + 1]);
+        int dy = std::abs(p[x] - p[x + stride]);
+        counts.horizontal += dx > kEdgeThreshold;
+        counts.strong += std::max(dx, dy) > kEdgeThreshold;
+    }
+    return counts;
+}
+
+} // namespace
+
+namespace SaliencyTiles {
+
+std::vector<Tile> rank(const uint8_t* rgb, int width, int height, int tile_size) {
+    std::vector<Tile> tiles;
+    if (!rgb || tile_size < kScale || tile_size % kScale != 0 || width % tile_size != 0 || height % tile_size != 0) {
+        return tiles;
+    }
+
+    // Quarter-scale luma thumbnail, with the last column and row repeated so
+    // every pixel has a right and a lower neighbour
+    const int tw = width / kScale;
+    const int th = height / kScale;
+    const int stride = tw + 1;
+    std::vector<uint8_t> thumb((size_t)stride * (th + 1));
+    std::vector<uint32_t> acc(tw);
+    for (int ty = 0; ty < th; ty++) {
+        std::fill(acc.begin(), acc.end(), 0);
+        for (int i = 0; i < kScale; i++) {
+            accumulateLumaRow(rgb + (size_t)(ty * kScale + i) * width * 3, width, acc.data());
+        }
+        uint8_t* out = thumb.data() + (size_t)ty * stride;
+        for (int tx = 0; tx < tw; tx++) {
+            out[tx] = (uint8_t)((acc[tx] + kScale * kScale / 2) / (kScale * kScale));
+        }
+        out[tw] = out[tw - 1];
+    }
+    std::memcpy(thumb.data() + (size_t)th * stride, thumb.data() + (size_t)(th - 1) * stride, stride);
+
+    const int cell = tile_size / kScale;
+    const int cols = width / tile_size;
+    const int rows = height / tile_size;
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            int strong = 0;
+            int text_rows = 0;
+            uint64_t sum = 0;
+            uint64_t sum_sq = 0;
+            for (int y = row * cell; y < (row + 1) * cell; y++) {
+                const uint8_t* p = thumb.data() + (size_t)y * stride + col * cell;
+                EdgeCounts counts = countEdges(p, cell, stride);
+                strong += counts.strong;
+
+                // Lines of text cross dense, regular luma steps along a row
+                text_rows += counts.horizontal * 8 >= cell;
+                for (int x = 0; x < cell; x++) {
+                    sum += p[x];
+                    sum_sq += (uint32_t)p[x] * p[x];
+                }
+            }
+            const double n = (double)cell * cell;
+            double mean = sum / n;
+            double stddev = std::sqrt(std::max(0.0, sum_sq / n - mean * mean));
+            float edges = std::min(1.0f, (float)(strong / n) / 0.15f);
+            float text = (float)text_rows / cell;
+            float variance = std::min(1.0f, (float)stddev / 64.0f);
+
+            Tile tile;
+            tile.col = col;
+            tile.row = row;
+            tile.score = 0.4f * edges + 0.4f * text + 0.2f * variance;
+            tiles.push_back(tile);
+        }
+    }
+    std::stable_sort(tiles.begin(), tiles.end(), [](const Tile& a, const Tile& b) { return a.score > b.score; });
+    return tiles;
+}
+
+mtmd::bitmap crop(const uint8_t* rgb, int width, int x, int y, int size) {
+    std::vector<uint8_t> out((size_t)size * size * 3);
+    for (int i = 0; i < size; i++) {
+        std::memcpy(out.data() + (size_t)i * size * 3, rgb + ((size_t)(y + i) * width + x) * 3, (size_t)size * 3);
+    }
+    return mtmd::bitmap(size, size, out.data());
+}
+
+mtmd::bitmap globalView(const uint8_t* rgb, int width, int height, int size) {
+    float scale = std::min(1.0f, (float)size / std::max(width, height));
+    int out_width = std::max(1, (int)std::lround(width * scale));
+    int out_height = std::max(1, (int)std::lround(height * scale));
+
+    std::vector<uint8_t> out((size_t)out_width * out_height * 3);
+    for (int oy = 0; oy < out_height; oy++) {
+        int y_begin = (int)((int64_t)oy * height / out_height);
+        int y_end = std::max(y_begin + 1, (int)((int64_t)(oy + 1) * height / out_height));
+        for (int ox = 0; ox < out_width; ox++) {
+            int x_begin = (int)((int64_t)ox * width / out_width);
+            int x_end = std::max(x_begin + 1, (int)((int64_t)(ox + 1) * width / out_width));
+            uint32_t sums[3] = {0, 0, 0};
+            for (int y = y_begin; y < y_end; y++) {
+                const uint8_t* px = rgb + ((size_t)y * width + x_begin) * 3;
+                for (int x = x_begin; x < x_end; x++, px += 3) {
+                    sums[0] += px[0];
+                    sums[1] += px[1];
+                    sums[2] += px[2];
+                }
+            }
+            uint32_t count = (uint32_t)(y_end - y_begin) * (uint32_t)(x_end - x_begin);
+            uint8_t* o = out.data() + ((size_t)oy * out_width + ox) * 3;
+            for (int c = 0; c < 3; c++) {
+                o[c] = (uint8_t)((sums[c] + count / 2) / count);
+            }
+        }
+    }
+    return mtmd::bitmap(out_width, out_height, out.data());
+}
+
+}  // namespace SaliencyTiles
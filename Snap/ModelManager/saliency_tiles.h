@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "mtmd.h"
+
+// Saliency pre-pass for tiled projectors. A preprocessed image is reduced to
+// a quarter-scale luma thumbnail and every tile is scored from its edge
+// density, how many of its rows look like lines of text, and its luma
+// variance. Flat tiles (sky, blank wall) score near zero, documents and
+// detailed subjects near one, so the encoder can be spent on the top tiles
+// only, next to a single global view of the whole frame.
+namespace SaliencyTiles {
+
+struct Tile {
+    int col = 0;
+    int row = 0;
+    float score = 0.0f;  // 0 (flat) to 1
+};
+
+// Scores each tile_size tile of a tile-aligned RGB image, best first;
+// empty when the image can't be split that way
+std::vector<Tile> rank(const uint8_t* rgb, int width, int height, int tile_size);
+
+// One tile of the image as its own bitmap
+mtmd::bitmap crop(const uint8_t* rgb, int width, int x, int y, int size);
+
+// The whole image area-averaged to fit within size x size
+mtmd::bitmap globalView(const uint8_t* rgb, int width, int height, int size);
+
+}  // namespace SaliencyTiles
@@ -0,0 +1,170 @@
+#include "session_store.h"
+#include "model_manager.h"
+#include <compression.h>
+#include <cstdio>
+
+namespace {
+
+// Groups the bytes of each 16-bit word: all low bytes, then all high bytes
+void shuffle(const uint8_t* src, size_t size, uint8_t* dst) {
+    size_t half = size / 2;
+    for (size_t i = 0; i < half; i++) {
+        dst[i] = src[2 * i];
+        dst[half + i] = src[2 * i + 1];
+    }
+    if (size % 2) {
+        dst[size - 1] = src[size - 1];
+    }
+}
+
+void unshuffle(const uint8_t* src, size_t size, uint8_t* dst) {
+    size_t half = size / 2;
+    for (size_t i = 0; i < half; i++) {
+        dst[2 * i] = src[i];
+        dst[2 * i + 1] = src[half + i];
+    }
+    if (size % 2) {
+        dst[size - 1] = src[size - 1];
+    }
+}
+
+} // namespace
+
+bool SessionStore::save(int session_id, const std::vector<uint8_t>& state) {
+    erase(session_id);
+
+    std::vector<uint8_t> shuffled(state.size());
+    shuffle(state.data(), state.size(), shuffled.data());
+
+    Entry entry;
+    entry.raw_size = state.size();
+    entry.data.resize(state.size());
+    size_t n = compression_encode_buffer(entry.data.data(), entry.data.size(), shuffled.data(), shuffled.size(),
+                                         nullptr, COMPRESSION_LZ4);
+    if (n > 0) {
+        entry.data.resize(n);
+        entry.data.shrink_to_fit();
+        entry.compressed = true;
+    } else {
+        // Didn't fit in the raw size, keep it uncompressed
+        entry.data = std::move(shuffled);
+    }
+    entry.last_use = ++use_counter;
+    LOGi("Session %d swapped out: %zu -> %zu bytes", session_id, entry.raw_size, entry.data.size());
+
+    ram_bytes += entry.data.size();
+    entries[session_id] = std::move(entry);
+    enforceBudget();
+    return true;
+}
+
+bool SessionStore::load(int session_id, std::vector<uint8_t>& state) {
+    auto it = entries.find(session_id);
+    if (it == entries.end()) {
+        return false;
+    }
+    Entry& entry = it->second;
+
+    if (!entry.path.empty()) {
+        FILE* f = fopen(entry.path.c_str(), "rb");
+        if (!f) {
+            LOGe("Failed to read spilled session %d", session_id);
+            erase(session_id);
+            return false;
+        }
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        entry.data.resize(size > 0 ? (size_t)size : 0);
+        bool ok = size > 0 && fread(entry.data.data(), 1, entry.data.size(), f) == entry.data.size();
+        fclose(f);
+        remove(entry.path.c_str());
+        entry.path.clear();
+        if (!ok) {
+            LOGe("Failed to read spilled session %d", session_id);
+            entries.erase(it);
+            return false;
+        }
+        ram_bytes += entry.data.size();
+    }
+
+    std::vector<uint8_t> shuffled;
+    if (entry.compressed) {
+        shuffled.resize(entry.raw_size);
+        size_t n = compression_decode_buffer(shuffled.data(), shuffled.size(), entry.data.data(), entry.data.size(),
+                                             nullptr, COMPRESSION_LZ4);
+        if (n != entry.raw_size) {
+            LOGe("Failed to decompress session %d", session_id);
+            erase(session_id);
+            return false;
+        }
+    } else {
+        ram_bytes -= entry.data.size();
+        shuffled = std::move(entry.data);
+    }
+    state.resize(entry.raw_size);
+    unshuffle(shuffled.data(), entry.raw_size, state.data());
+
+    erase(session_id);
+    return true;
+}
+
+void SessionStore::erase(int session_id) {
+    auto it = entries.find(session_id);
+    if (it == entries.end()) {
+        return;
+    }
+    ram_bytes -= it->second.data.size();
+    if (!it->second.path.empty()) {
+        remove(it->second.path.c_str());
+    }
+    entries.erase(it);
+}
+
+void SessionStore::clear() {
+    while (!entries.empty()) {
+        erase(entries.begin()->first);
+    }
+}
+
+void SessionStore::enforceBudget() {
+    while (ram_bytes > ram_budget) {
+        // Least recently used state still in RAM
+        auto victim = entries.end();
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (!it->second.data.empty() && (victim == entries.end() || it->second.last_use < victim->second.last_use)) {
+                victim = it;
+            }
+        }
+        if (victim == entries.end()) {
+            return;
+        }
+        if (!spill(victim->first, victim->second)) {
+            LOGi("Dropping swapped-out session %d", victim->first);
+            erase(victim->first);
+        }
+    }
+}
+
+bool SessionStore::spill(int session_id, Entry& entry) {
+    if (spill_dir.empty()) {
+        return false;
+    }
+    std::string path = spill_dir + "/session-" + std::to_string(session_id) + ".kv";
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    bool ok = fwrite(entry.data.data(), 1, entry.data.size(), f) == entry.data.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        remove(path.c_str());
+        return false;
+    }
+    LOGi("Session %d spilled to disk", session_id);
+    ram_bytes -= entry.data.size();
+    entry.data.clear();
+    entry.data.shrink_to_fit();
+    entry.path = path;
+    return true;
+}
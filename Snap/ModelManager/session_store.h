@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Swapped-out KV state of idle sessions. States are byte-shuffled (the KV
+// payload is mostly F16, so splitting high and low bytes gives LZ4 long
+// runs) and LZ4-compressed into host RAM. Past the RAM budget the least
+// recently used states are spilled to files, or dropped if no spill
+// directory is set.
+class SessionStore {
+public:
+    SessionStore() = default;
+    SessionStore(const SessionStore&) = delete;
+    SessionStore& operator=(const SessionStore&) = delete;
+    ~SessionStore() { clear(); }
+
+    void setRamBudget(size_t bytes) { ram_budget = bytes; }
+    void setSpillDir(const std::string& dir) { spill_dir = dir; }
+
+    bool save(int session_id, const std::vector<uint8_t>& state);
+    // Removes the entry; returns false if it was never saved or was dropped
+    bool load(int session_id, std::vector<uint8_t>& state);
+    void erase(int session_id);
+    void clear();
+
+    size_t ramBytes() const { return ram_bytes; }
+
+private:
+    struct Entry {
+        std::vector<uint8_t> data;  // empty once spilled
+        std::string path;           // set once spilled
+        size_t raw_size = 0;
+        bool compressed = false;
+        uint64_t last_use = 0;
+    };
+
+    void enforceBudget();
+    bool spill(int session_id, Entry& entry);
+
+    std::map<int, Entry> entries;
+    size_t ram_budget = 256u << 20;
+    size_t ram_bytes = 0;
+    std::string spill_dir;
+    uint64_t use_counter = 0;
+};
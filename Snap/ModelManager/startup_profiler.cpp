@@ -0,0 +1,39 @@
+#include "startup_profiler.h"
+#include "model_manager.h"
+#include <cstdio>
+
+StartupProfiler::Scope::Scope(StartupProfiler& profiler, const char* name)
+    : profiler(profiler), name(name), t_start_us(ggml_time_us()) {}
+
+StartupProfiler::Scope::~Scope() {
+    profiler.record(name, t_start_us, ggml_time_us());
+}
+
+void StartupProfiler::begin() {
+    std::lock_guard<std::mutex> lock(mutex);
+    t_begin_us = ggml_time_us();
+    entries.clear();
+}
+
+void StartupProfiler::record(const char* name, int64_t t_start_us, int64_t t_end_us) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stage stage = {name, (t_start_us - t_begin_us) / 1000.0, (t_end_us - t_start_us) / 1000.0};
+    LOGi("Startup stage %s: %.1f ms at +%.1f ms", name, stage.duration_ms, stage.start_ms);
+    entries.push_back(std::move(stage));
+}
+
+std::vector<StartupProfiler::Stage> StartupProfiler::stages() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries;
+}
+
+std::string StartupProfiler::report() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string out;
+    char line[160];
+    for (const Stage& stage : entries) {
+        snprintf(line, sizeof(line), "%s %.1f %.1f\n", stage.name.c_str(), stage.start_ms, stage.duration_ms);
+        out += line;
+    }
+    return out;
+}
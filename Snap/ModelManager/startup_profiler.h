@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Timeline of the model load path. Stages are recorded relative to the
+// start of the load, from whichever thread runs them, so stages that
+// overlap (a background mmproj read, lazy vision context creation) show up
+// as such.
+class StartupProfiler {
+public:
+    struct Stage {
+        std::string name;
+        double start_ms;     // since begin()
+        double duration_ms;
+    };
+
+    // Times the enclosing block
+    class Scope {
+    public:
+        Scope(StartupProfiler& profiler, const char* name);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        StartupProfiler& profiler;
+        const char* name;
+        int64_t t_start_us;
+    };
+
+    void begin();
+    void record(const char* name, int64_t t_start_us, int64_t t_end_us);
+
+    std::vector<Stage> stages();
+    // One "name start_ms duration_ms" line per stage
+    std::string report();
+
+private:
+    std::mutex mutex;
+    int64_t t_begin_us = 0;
+    std::vector<Stage> entries;
+};
@@ -0,0 +1,214 @@
+#include "vqa_evaluator.h"
+#include "model_manager.h"
+#include "process_stats.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+// VQA answer normalization: lowercase, no punctuation or articles, number
+// words as digits
+std::string VqaEvaluator::normalize(const std::string& text) {
+    static const char* numbers[] = {"zero", "one", "two", "three", "four", "five",
+                                    "six", "seven", "eight", "nine", "ten"};
+    std::string cleaned;
+    for (char c : text) {
+        cleaned += std::ispunct((unsigned char)c) ? ' ' : (char)std::tolower((unsigned char)c);
+    }
+    std::istringstream words(cleaned);
+    std::string word;
+    std::string out;
+    while (words >> word) {
+        if (word == "a" || word == "an" || word == "the") {
+            continue;
+        }
+        for (int i = 0; i <= 10; i++) {
+            if (word == numbers[i]) {
+                word = std::to_string(i);
+            }
+        }
+        out += out.empty() ? word : " " + word;
+    }
+    return out;
+}
+
+bool VqaEvaluator::loadSet(const char* set_path) {
+    std::ifstream file(set_path);
+    if (!file) {
+        LOGe("Failed to open VQA set %s", set_path);
+        return false;
+    }
+    std::string dir = set_path;
+    dir = dir.substr(0, dir.find_last_of('/') + 1);
+
+    items.clear();
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t tab1 = line.find('\t');
+        size_t tab2 = tab1 == std::string::npos ? tab1 : line.find('\t', tab1 + 1);
+        if (tab2 == std::string::npos) {
+            continue;
+        }
+        Item item;
+        item.image_path = line.substr(0, tab1);
+        if (!item.image_path.empty() && item.image_path[0] != '/') {
+            item.image_path = dir + item.image_path;
+        }
+        item.question = line.substr(tab1 + 1, tab2 - tab1 - 1);
+        std::istringstream answers(line.substr(tab2 + 1));
+        std::string answer;
+        while (std::getline(answers, answer, '|')) {
+            item.answers.push_back(normalize(answer));
+        }
+        items.push_back(std::move(item));
+    }
+    LOGi("Loaded %zu VQA items from %s", items.size(), set_path);
+    return !items.empty();
+}
+
+bool VqaEvaluator::runConfig(const Config& config, Report& report) {
+    report = Report();
+    report.name = config.name;
+
+    // An app-set speculative prompt would answer ahead of the clock
+    bool speculative = config.speculative_think_ms > 0;
+    manager.setSpeculativePrompt(nullptr, 0);
+    manager.setKvCacheType(config.kv_type);
+    manager.setImageBudget(config.visual_tokens, 0.0f);
+    manager.setMaxImageEdge(config.max_image_edge);
+    struct Defaults {
+        ModelManager& manager;
+        ~Defaults() {
+            manager.setSpeculativePrompt(nullptr, 0);
+            manager.setKvCacheType(GGML_TYPE_F16);
+            manager.setImageBudget(0, 0.0f);
+            manager.setMaxImageEdge(0);
+        }
+    } defaults{manager};
+
+    if (!manager.loadLanguageModel(config.lm_path.c_str()) || !manager.loadVisionModel(config.mmproj_path.c_str()) ||
+        !manager.initializeContext() || !manager.initializeBatch() || !manager.initializeSampler() ||
+        !manager.initializeChatTemplate()) {
+        LOGe("Failed to load configuration %s", config.name.c_str());
+        return false;
+    }
+
+    std::vector<double> ttfts;
+    double exact = 0.0;
+    double contains = 0.0;
+    double decode_s = 0.0;
+    double cpu_s = 0.0;
+    long decode_tokens = 0;
+    for (const Item& item : items) {
+        manager.resetConversation(0);
+        int64_t t_start_us = ggml_time_us();
+        int64_t t_first_us = 0;
+        int n_tokens = 0;
+        double cpu_start = cpuSeconds();
+        std::string reply;
+        if (speculative) {
+            manager.setSpeculativePrompt(item.question.c_str(), config.max_tokens);
+        }
+        bool ok = manager.processImage(0, item.image_path.c_str(), speculative);
+        if (speculative) {
+            // The user reads the capture before asking
+            std::this_thread::sleep_for(std::chrono::milliseconds(config.speculative_think_ms));
+            t_start_us = ggml_time_us();
+        }
+        ok = ok && manager.generateResponse(0, item.question.c_str(), config.max_tokens,
+                      [&](const std::string& token) {
+                          if (n_tokens++ == 0) {
+                              t_first_us = ggml_time_us();
+                          }
+                          reply += token;
+                          report.peak_mb = std::max(report.peak_mb, physFootprintMb());
+                      }, false);
+        int64_t t_end_us = ggml_time_us();
+        cpu_s += cpuSeconds() - cpu_start;
+        if (!ok || n_tokens == 0) {
+            report.n_failed++;
+            continue;
+        }
+
+        ttfts.push_back((t_first_us - t_start_us) / 1000.0);
+        decode_s += (t_end_us - t_first_us) / 1e6;
+        decode_tokens += n_tokens - 1;
+
+        std::string answer = normalize(reply);
+        std::string padded = " " + answer + " ";
+        int matches = 0;
+        bool found = false;
+        for (const std::string& reference : item.answers) {
+            matches += reference == answer;
+            found = found || padded.find(" " + reference + " ") != std::string::npos;
+        }
+        exact += std::min(1.0, matches / 3.0);
+        contains += found ? 1.0 : 0.0;
+    }
+    manager.resetConversation(0);
+
+    report.n_items = (int)items.size();
+    int n_ok = report.n_items - report.n_failed;
+    if (n_ok > 0) {
+        // Failed items count as wrong
+        report.exact = exact / report.n_items;
+        report.contains = contains / report.n_items;
+        double sum = 0.0;
+        for (double t : ttfts) {
+            sum += t;
+        }
+        report.ttft_ms = sum / n_ok;
+        std::sort(ttfts.begin(), ttfts.end());
+        report.ttft_p90_ms = ttfts[std::min(ttfts.size() - 1, ttfts.size() * 9 / 10)];
+        report.tokens_per_s = decode_s > 0 ? decode_tokens / decode_s : 0.0;
+    }
+    report.cpu_s = cpu_s / report.n_items;
+    // Selective tiling against the full split shows up here and in accuracy
+    report.image_tokens = (double)manager.getImageTokens() / report.n_items;
+    LOGi("VQA %s: exact %.3f, contains %.3f, TTFT %.0f ms, %.1f tokens/s, peak %.0f MB, %.2f CPU s/item, "
+         "%.0f image tokens/item",
+         report.name.c_str(), report.exact, report.contains, report.ttft_ms, report.tokens_per_s, report.peak_mb,
+         report.cpu_s, report.image_tokens);
+    return true;
+}
+
+bool VqaEvaluator::run(const std::vector<Config>& configs, std::vector<Report>& reports) {
+    reports.clear();
+    if (items.empty()) {
+        return false;
+    }
+    for (const Config& config : configs) {
+        Report report;
+        if (runConfig(config, report)) {
+            reports.push_back(report);
+        }
+    }
+
+    for (Report& report : reports) {
+        report.pareto = std::none_of(reports.begin(), reports.end(), [&](const Report& other) {
+            return other.exact >= report.exact && other.ttft_ms <= report.ttft_ms &&
+                   (other.exact > report.exact || other.ttft_ms < report.ttft_ms);
+        });
+    }
+    return !reports.empty();
+}
+
+bool VqaEvaluator::writeReport(const std::vector<Report>& reports, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        LOGe("Failed to write VQA report to %s", path);
+        return false;
+    }
+    fprintf(file, "config,items,failed,exact,contains,ttft_ms,ttft_p90_ms,tokens_per_s,peak_mb,cpu_s,image_tokens,"
+                  "pareto\n");
+    for (const Report& r : reports) {
+        fprintf(file, "%s,%d,%d,%.4f,%.4f,%.1f,%.1f,%.2f,%.1f,%.3f,%.1f,%d\n", r.name.c_str(), r.n_items,
+                r.n_failed, r.exact, r.contains, r.ttft_ms, r.ttft_p90_ms, r.tokens_per_s, r.peak_mb, r.cpu_s,
+                r.image_tokens, r.pareto ? 1 : 0);
+    }
+    fclose(file);
+    return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "ggml.h"
+
+class ModelManager;
+
+// Accuracy against speed over a local visual question answering set, for
+// one or more model configurations. The set is a TSV file with one item per
+// line:
+//
+//   image_path <TAB> question <TAB> answer[|answer...]
+//
+// Relative image paths are resolved against the set's directory. Each item
+// is asked in a fresh conversation of session 0, the one every reload
+// leaves in place. Configurations are loaded in turn and the settings they
+// change are put back to their defaults (speculation off), so the caller
+// must reload its own models and settings afterwards.
+class VqaEvaluator {
+public:
+    struct Config {
+        std::string name;
+        std::string lm_path;
+        std::string mmproj_path;
+        int max_tokens = 64;
+        int visual_tokens = 0;   // per-image budget for selective tiling, zero keeps every tile
+        int max_image_edge = 0;  // longest image edge, zero for the projector's own
+        ggml_type kv_type = GGML_TYPE_F16;
+        // Speculative reply: with think_ms > 0 each question is also the
+        // speculative prompt, answered in the background during think_ms of
+        // reading time after the image is ingested, and TTFT is measured from
+        // the question. Otherwise speculation is off for the run.
+        int speculative_think_ms = 0;
+    };
+
+    struct Report {
+        std::string name;
+        int n_items = 0;
+        int n_failed = 0;
+        double exact = 0.0;       // VQA accuracy: min(1, matching answers / 3)
+        double contains = 0.0;    // any reference answer appears in the reply
+        double ttft_ms = 0.0;     // mean, image ingest and prefill included unless speculative
+        double ttft_p90_ms = 0.0;
+        double tokens_per_s = 0.0;
+        double peak_mb = 0.0;     // peak physical footprint while generating
+        double cpu_s = 0.0;       // mean CPU time per item, an energy proxy
+        double image_tokens = 0.0;  // mean LM positions per item taken by the image
+        bool pareto = false;      // not beaten on both exact accuracy and TTFT
+    };
+
+    explicit VqaEvaluator(ModelManager& manager) : manager(manager) {}
+
+    bool loadSet(const char* set_path);
+    bool run(const std::vector<Config>& configs, std::vector<Report>& reports);
+
+    // CSV, one row per configuration
+    static bool writeReport(const std::vector<Report>& reports, const char* path);
+
+private:
+    struct Item {
+        std::string image_path;
+        std::string question;
+        std::vector<std::string> answers;
+    };
+
+    bool runConfig(const Config& config, Report& report);
+    static std::string normalize(const std::string& text);
+
+    ModelManager& manager;
+    std::vector<Item> items;
+};
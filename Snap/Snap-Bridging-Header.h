@@ -8,9 +8,16 @@ extern "C" {
 // Callback type for streaming tokens
 typedef void (*TokenCallback)(const char* token, void* user_data);
 
+// Called per batch input; representative is the index whose caption it shares
+typedef void (*BatchItemCallback)(int index, int representative, const char* caption, void* user_data);
+
 // Model Manager wrapper functions
 void* create_model_manager(void);
 void destroy_model_manager(void* manager);
+void set_parallel_load(void* manager, bool enabled);
+// Where compressed model archives are decoded to on load
+void set_model_cache_dir(void* manager, const char* dir);
+bool apply_model_delta(const char* base_path, const char* delta_path, const char* out_path);
 bool load_language_model(void* manager, const char* model_path);
 bool load_vision_model(void* manager, const char* mmproj_path);
 bool initialize_context(void* manager);
@@ -18,9 +25,48 @@ bool initialize_batch(void* manager);
 bool initialize_sampler(void* manager);
 bool initialize_chat_template(void* manager, const char* template_name);
 bool process_image(void* manager, const char* image_path);
+// Queues several images for one prompt within a shared budget of LM tokens
+bool process_images(void* manager, const char** image_paths, int n_images, int max_visual_tokens);
+// RGBX pixels; without queue the image is only pre-encoded for a later prompt,
+// speculate marks a camera capture that may start the speculative reply
+bool process_image_pixels(void* manager, const unsigned char* pixels, int width, int height, int stride, bool queue,
+                          bool speculate);
+// Per-image LM token and encoder ms budget for selective tiling; zero disables
+void set_image_budget(void* manager, int max_tokens, float max_ms);
+// Knob arrays (visual token budget, longest image edge, ggml KV type, speculative
+// think time in ms) may each be null for the defaults
+bool run_vqa_eval(void* manager, const char* set_path, const char** names, const char** lm_paths,
+                  const char** mmproj_paths, const int* visual_tokens, const int* max_image_edges,
+                  const int* kv_types, const int* speculative_think_ms, int n_configs, int max_tokens,
+                  const char* report_path);
+bool run_quant_sweep(void* manager, const char* lm_f16_path, const char* mmproj_f16_path, const char* out_dir,
+                     const char** image_paths, const char** prompts, int n_prompts, int max_tokens,
+                     const char* report_path);
+int get_readiness(void* manager);
+char* get_startup_profile(void* manager);
 char* generate_response(void* manager, const char* prompt, int max_tokens);
 void free_response(char* response);
 bool generate_response_stream(void* manager, const char* prompt, int max_tokens, TokenCallback callback, void* user_data);
+bool caption_batch(void* manager, const char** image_paths, int n_images, const char* prompt, int max_tokens, int dedup_threshold, bool shared_prefix, BatchItemCallback callback, void* user_data);
+void reset_conversation(void* manager);
+bool predict_output_length(void* manager, const char* prompt, bool has_image, int max_tokens, int* expected, int* p95);
+void set_decode_pacing(void* manager, float tokens_per_second);
+// Generates the reply to prompt in the background after an image capture
+void set_speculative_prompt(void* manager, const char* prompt, int max_tokens);
+// Drops an image's KV cells after max_turns turns or a new image; 0 keeps them
+void set_image_retention(void* manager, int max_turns, bool summarize);
+void finish_response(void* manager);
+int create_session(void* manager);
+// Points the handle at another session
+bool switch_session(void* manager, int session_id);
+// A handle of its own on a new session, for a concurrent caller
+void* open_session_handle(void* manager);
+void close_session_handle(void* handle);
+void close_session(void* manager, int session_id);
+void set_session_weight(void* manager, int session_id, float weight);
+// Inter-token latency percentiles (ms) for a session; returns the sample count
+int get_token_latency(void* manager, int session_id, float* p50, float* p95, float* p99);
+void set_session_spill_dir(void* manager, const char* dir);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,119 @@
+//
+//  FairSchedulerTests.swift
+//  SnapTests
+//
+
+import Testing
+
+struct Demand {
+    var session: Int32
+    var tokens: Int32
+    var decode = false
+    var expected: Int32 = 0
+    var background = false
+}
+
+// Owns a scheduler for the length of a test
+final class SchedulerHandle {
+    let scheduler: UnsafeMutableRawPointer
+
+    init(prefillChunk: Int32 = 64) {
+        scheduler = test_scheduler_create(prefillChunk)
+    }
+
+    deinit {
+        test_scheduler_destroy(scheduler)
+    }
+
+    func setWeight(_ session: Int32, _ weight: Float) {
+        test_scheduler_set_weight(scheduler, session, weight)
+    }
+
+    func plan(_ demands: [Demand], batch: Int32) -> [Int32] {
+        var grants = [Int32](repeating: 0, count: demands.count)
+        test_scheduler_plan(scheduler, demands.map(\.session), demands.map(\.tokens), demands.map(\.decode),
+                            demands.map(\.expected), demands.map(\.background), Int32(demands.count), batch,
+                            &grants)
+        return grants
+    }
+}
+
+struct FairSchedulerTests {
+
+    @Test func repliesAdvanceTogether() {
+        let handle = SchedulerHandle(prefillChunk: 64)
+        let grants = handle.plan([Demand(session: 1, tokens: 1, decode: true),
+                                  Demand(session: 2, tokens: 1, decode: true),
+                                  Demand(session: 3, tokens: 1, decode: true),
+                                  Demand(session: 4, tokens: 500)], batch: 512)
+        // One token per reply, and prefill capped at the chunk while replies decode
+        #expect(grants == [1, 1, 1, 64])
+
+        // Without replies, prefill takes the whole batch
+        #expect(handle.plan([Demand(session: 4, tokens: 500)], batch: 512) == [500])
+    }
+
+    @Test func grantsStayWithinDemandAndBatch() {
+        let handle = SchedulerHandle(prefillChunk: 32)
+        for _ in 0..<200 {
+            let demands = (1...6).map { session in
+                let decode = Bool.random()
+                return Demand(session: Int32(session), tokens: decode ? 1 : Int32.random(in: 0...300), decode: decode,
+                              expected: Int32.random(in: 0...400), background: session == 6)
+            }
+            let batch = Int32.random(in: 1...128)
+            let grants = handle.plan(demands, batch: batch)
+            #expect(grants.reduce(0, +) <= batch)
+            for (demand, grant) in zip(demands, grants) {
+                #expect(grant >= 0 && grant <= max(demand.tokens, 0))
+            }
+            let decoders = demands.filter { $0.decode && !$0.background && $0.tokens > 0 }.count
+            if decoders > 0 && batch > decoders {
+                let prefill = zip(demands, grants).filter { !$0.0.decode && !$0.0.background }.map { $0.1 }
+                #expect(prefill.reduce(0, +) <= 32)
+            }
+        }
+    }
+
+    @Test func prefillSplitsByWeight() {
+        let handle = SchedulerHandle(prefillChunk: 64)
+        handle.setWeight(1, 1)
+        handle.setWeight(2, 3)
+        var totals: [Int32] = [0, 0]
+        for _ in 0..<100 {
+            let grants = handle.plan([Demand(session: 1, tokens: 1000), Demand(session: 2, tokens: 1000)],
+                                     batch: 64)
+            totals[0] += grants[0]
+            totals[1] += grants[1]
+        }
+        #expect(totals == [1600, 4800])
+    }
+
+    @Test func longRepliesAreNotStarved() {
+        // Fewer batch slots than replies: shorter predicted replies go first,
+        // but waiting ages the long one until it is served
+        let handle = SchedulerHandle()
+        var served: [Bool] = [false, false, false]
+        for _ in 0..<40 {
+            let grants = handle.plan([Demand(session: 1, tokens: 1, decode: true, expected: 5),
+                                      Demand(session: 2, tokens: 1, decode: true, expected: 50),
+                                      Demand(session: 3, tokens: 1, decode: true, expected: 500)], batch: 2)
+            #expect(grants.reduce(0, +) == 2)
+            for i in 0..<3 where grants[i] > 0 {
+                served[i] = true
+            }
+        }
+        #expect(served == [true, true, true])
+    }
+
+    @Test func backgroundTakesOnlyLeftovers() {
+        let handle = SchedulerHandle(prefillChunk: 64)
+        #expect(handle.plan([Demand(session: 1, tokens: 1000), Demand(session: 2, tokens: 1000, background: true)],
+                            batch: 64) == [64, 0])
+        #expect(handle.plan([Demand(session: 1, tokens: 1, decode: true), Demand(session: 2, tokens: 1000),
+                             Demand(session: 3, tokens: 1000, background: true)], batch: 512) == [1, 64, 1])
+        #expect(handle.plan([Demand(session: 1, tokens: 1, decode: true),
+                             Demand(session: 3, tokens: 1000, background: true)], batch: 512) == [1, 64])
+    }
+
+}
@@ -0,0 +1,109 @@
+//
+//  GgufDeltaTests.swift
+//  SnapTests
+//
+
+import Foundation
+import Testing
+
+struct GgufDeltaTests {
+
+    let dir: URL
+
+    init() throws {
+        dir = FileManager.default.temporaryDirectory.appendingPathComponent(UUID().uuidString)
+        try FileManager.default.createDirectory(at: dir, withIntermediateDirectories: true)
+    }
+
+    // Minimal GGUF v3: a general.name string and 1-D F32 tensors, with the
+    // data section and each tensor aligned to the default 32 bytes
+    func gguf(name: String, tensors: [(String, [Float])]) -> Data {
+        var data = Data()
+        func u32(_ value: UInt32) { withUnsafeBytes(of: value.littleEndian) { data.append(contentsOf: $0) } }
+        func u64(_ value: UInt64) { withUnsafeBytes(of: value.littleEndian) { data.append(contentsOf: $0) } }
+        func string(_ value: String) {
+            u64(UInt64(value.utf8.count))
+            data.append(contentsOf: Array(value.utf8))
+        }
+        func pad() {
+            while data.count % 32 != 0 { data.append(0) }
+        }
+
+        data.append(contentsOf: Array("GGUF".utf8))
+        u32(3)
+        u64(UInt64(tensors.count))
+        u64(1)
+        string("general.name")
+        u32(8)  // GGUF_TYPE_STRING
+        string(name)
+        var offset: UInt64 = 0
+        for (tensorName, values) in tensors {
+            string(tensorName)
+            u32(1)
+            u64(UInt64(values.count))
+            u32(0)  // GGML_TYPE_F32
+            u64(offset)
+            offset += UInt64((values.count * 4 + 31) / 32 * 32)
+        }
+        pad()
+        for (_, values) in tensors {
+            for value in values { u32(value.bitPattern) }
+            pad()
+        }
+        return data
+    }
+
+    func values(_ count: Int, _ seed: Float) -> [Float] {
+        (0..<count).map { Float($0) * 0.25 + seed }
+    }
+
+    // Copied, XORed and resized tensors plus changed metadata
+    func writeModels() throws -> (base: URL, target: URL, targetData: Data) {
+        var tuned = values(4096, 2)
+        tuned[17] = -1
+        let base = gguf(name: "base", tensors: [("frozen", values(4096, 1)), ("tuned", values(4096, 2)),
+                                                ("resized", values(64, 3))])
+        let target = gguf(name: "fine-tuned", tensors: [("frozen", values(4096, 1)), ("tuned", tuned),
+                                                        ("resized", values(96, 3)), ("added", values(40, 4))])
+        let baseURL = dir.appendingPathComponent("base.gguf")
+        let targetURL = dir.appendingPathComponent("target.gguf")
+        try base.write(to: baseURL)
+        try target.write(to: targetURL)
+        return (baseURL, targetURL, target)
+    }
+
+    @Test func roundTrip() throws {
+        let models = try writeModels()
+        let delta = dir.appendingPathComponent("update.delta")
+        let out = dir.appendingPathComponent("out.gguf")
+
+        #expect(test_delta_create(models.base.path, models.target.path, delta.path))
+        let deltaSize = try FileManager.default.attributesOfItem(atPath: delta.path)[.size] as? Int ?? 0
+        #expect(deltaSize < models.targetData.count)
+
+        #expect(test_delta_apply(models.base.path, delta.path, out.path))
+        #expect(try Data(contentsOf: out) == models.targetData)
+    }
+
+    @Test func applyInPlace() throws {
+        let models = try writeModels()
+        let delta = dir.appendingPathComponent("update.delta")
+        #expect(test_delta_create(models.base.path, models.target.path, delta.path))
+
+        #expect(test_delta_apply(models.base.path, delta.path, models.base.path))
+        #expect(try Data(contentsOf: models.base) == models.targetData)
+    }
+
+    @Test func rejectsOtherBase() throws {
+        let models = try writeModels()
+        let delta = dir.appendingPathComponent("update.delta")
+        let out = dir.appendingPathComponent("out.gguf")
+        #expect(test_delta_create(models.base.path, models.target.path, delta.path))
+
+        // The delta is pinned to its base; the target is not that base
+        #expect(!test_delta_apply(models.target.path, delta.path, out.path))
+        #expect(!FileManager.default.fileExists(atPath: out.path))
+        #expect(!FileManager.default.fileExists(atPath: out.path + ".tmp"))
+    }
+
+}
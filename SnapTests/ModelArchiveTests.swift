@@ -0,0 +1,72 @@
+//
+//  ModelArchiveTests.swift
+//  SnapTests
+//
+
+import Foundation
+import Testing
+
+struct ModelArchiveTests {
+
+    let dir: URL
+
+    init() throws {
+        dir = FileManager.default.temporaryDirectory.appendingPathComponent(UUID().uuidString)
+        try FileManager.default.createDirectory(at: dir, withIntermediateDirectories: true)
+    }
+
+    // Compressible and incompressible blocks, with a partial block at the end
+    func sampleModel(blockSize: Int) -> Data {
+        var generator = SystemRandomNumberGenerator()
+        var bytes = [UInt8](repeating: 0, count: blockSize * 3 + blockSize / 3)
+        for i in 0..<bytes.count {
+            bytes[i] = i / blockSize == 1 ? UInt8.random(in: 0...255, using: &generator) : UInt8(i % 7)
+        }
+        return Data(bytes)
+    }
+
+    @Test func roundTrip() throws {
+        let blockSize = 4096
+        let model = sampleModel(blockSize: blockSize)
+        let src = dir.appendingPathComponent("model.gguf")
+        let archive = dir.appendingPathComponent("model.snpz")
+        let out = dir.appendingPathComponent("unpacked.gguf")
+        try model.write(to: src)
+
+        #expect(test_archive_pack(src.path, archive.path, UInt32(blockSize)))
+        #expect(test_archive_is_archive(archive.path))
+        #expect(!test_archive_is_archive(src.path))
+
+        #expect(test_archive_unpack(archive.path, out.path, 3))
+        #expect(try Data(contentsOf: out) == model)
+    }
+
+    @Test func unpackInPlace() throws {
+        let model = sampleModel(blockSize: 1024)
+        let path = dir.appendingPathComponent("model.gguf")
+        try model.write(to: path)
+        #expect(test_archive_pack(path.path, path.path + ".snpz", 1024))
+        try FileManager.default.removeItem(at: path)
+        try FileManager.default.moveItem(atPath: path.path + ".snpz", toPath: path.path)
+
+        #expect(test_archive_unpack(path.path, path.path, 2))
+        #expect(!test_archive_is_archive(path.path))
+        #expect(try Data(contentsOf: path) == model)
+    }
+
+    @Test func rejectsCorruptHeader() throws {
+        let src = dir.appendingPathComponent("model.gguf")
+        let archive = dir.appendingPathComponent("model.snpz")
+        let out = dir.appendingPathComponent("unpacked.gguf")
+        try sampleModel(blockSize: 1024).write(to: src)
+        #expect(test_archive_pack(src.path, archive.path, 1024))
+
+        // A block count that doesn't match the raw size
+        var bytes = try Data(contentsOf: archive)
+        bytes[20] ^= 0xff
+        try bytes.write(to: archive)
+        #expect(!test_archive_unpack(archive.path, out.path, 2))
+        #expect(!FileManager.default.fileExists(atPath: out.path))
+    }
+
+}
@@ -0,0 +1,102 @@
+//
+//  SessionStoreTests.swift
+//  SnapTests
+//
+
+import Foundation
+import Testing
+
+// Owns a store for the length of a test
+final class SessionStoreHandle {
+    let store: UnsafeMutableRawPointer
+
+    init(ramBudget: Int, spillDir: String? = nil) {
+        store = test_session_store_create(ramBudget, spillDir)
+    }
+
+    deinit {
+        test_session_store_destroy(store)
+    }
+
+    func save(_ id: Int32, _ state: [UInt8]) -> Bool {
+        test_session_store_save(store, id, state, state.count)
+    }
+
+    func load(_ id: Int32, capacity: Int = 1 << 16) -> [UInt8]? {
+        var state = [UInt8](repeating: 0, count: capacity)
+        var size = 0
+        guard test_session_store_load(store, id, &state, capacity, &size) else { return nil }
+        return Array(state.prefix(size))
+    }
+
+    var ramBytes: Int { test_session_store_ram_bytes(store) }
+}
+
+struct SessionStoreTests {
+
+    // Odd length so the byte shuffle has a trailing byte
+    func randomState(_ count: Int = 10_001) -> [UInt8] {
+        (0..<count).map { _ in UInt8.random(in: 0...255) }
+    }
+
+    // F16-like: low bytes vary, high bytes repeat
+    func kvState(_ count: Int = 10_001) -> [UInt8] {
+        (0..<count).map { $0 % 2 == 0 ? UInt8($0 / 2 % 251) : 0x3c }
+    }
+
+    @Test func saveAndLoad() {
+        let handle = SessionStoreHandle(ramBudget: 1 << 20)
+        let random = randomState()
+        let kv = kvState()
+        #expect(handle.save(1, random))
+        #expect(handle.save(2, kv))
+        #expect(handle.ramBytes < random.count + kv.count)
+
+        #expect(handle.load(1) == random)
+        #expect(handle.load(2) == kv)
+        // Loading takes the state out
+        #expect(handle.load(1) == nil)
+        #expect(handle.ramBytes == 0)
+    }
+
+    @Test func saveReplaces() {
+        let handle = SessionStoreHandle(ramBudget: 1 << 20)
+        let newer = randomState(5_000)
+        #expect(handle.save(1, randomState()))
+        #expect(handle.save(1, newer))
+        #expect(handle.ramBytes <= newer.count)
+        #expect(handle.load(1) == newer)
+    }
+
+    @Test func spillsLeastRecentlyUsed() throws {
+        let dir = FileManager.default.temporaryDirectory.appendingPathComponent(UUID().uuidString)
+        try FileManager.default.createDirectory(at: dir, withIntermediateDirectories: true)
+        let spilled = dir.appendingPathComponent("session-1.kv").path
+        let handle = SessionStoreHandle(ramBudget: 25_000, spillDir: dir.path)
+        let states = [randomState(), randomState(), randomState()]
+        for (i, state) in states.enumerated() {
+            #expect(handle.save(Int32(i + 1), state))
+        }
+        #expect(handle.ramBytes <= 25_000)
+        #expect(FileManager.default.fileExists(atPath: spilled))
+
+        #expect(handle.load(1) == states[0])
+        #expect(!FileManager.default.fileExists(atPath: spilled))
+        #expect(handle.load(2) == states[1])
+        #expect(handle.load(3) == states[2])
+        #expect(handle.ramBytes == 0)
+    }
+
+    @Test func dropsWithoutSpillDir() {
+        let handle = SessionStoreHandle(ramBudget: 25_000)
+        let states = [randomState(), randomState(), randomState()]
+        for (i, state) in states.enumerated() {
+            #expect(handle.save(Int32(i + 1), state))
+        }
+        #expect(handle.ramBytes <= 25_000)
+        #expect(handle.load(1) == nil)
+        #expect(handle.load(2) == states[1])
+        #expect(handle.load(3) == states[2])
+    }
+
+}
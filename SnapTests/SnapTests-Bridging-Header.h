@@ -0,0 +1,43 @@
+#ifndef SnapTests_Bridging_Header_h
+#define SnapTests_Bridging_Header_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// C entry points into the app's C++ units under test, see test_hooks.cpp.
+// The units themselves are resolved against the host app.
+
+// Model archive
+bool test_archive_is_archive(const char* path);
+bool test_archive_pack(const char* src_path, const char* dst_path, uint32_t block_size);
+bool test_archive_unpack(const char* src_path, const char* dst_path, int n_threads);
+
+// GGUF deltas
+bool test_delta_create(const char* base_path, const char* target_path, const char* delta_path);
+bool test_delta_apply(const char* base_path, const char* delta_path, const char* out_path);
+
+// Session store; spill_dir may be null to drop states past the budget
+void* test_session_store_create(size_t ram_budget, const char* spill_dir);
+void test_session_store_destroy(void* store);
+bool test_session_store_save(void* store, int session_id, const uint8_t* state, size_t size);
+// Copies at most capacity bytes of the state out and sets size to its full size
+bool test_session_store_load(void* store, int session_id, uint8_t* state, size_t capacity, size_t* size);
+size_t test_session_store_ram_bytes(void* store);
+
+// Fair scheduler; demands are given as parallel arrays of n_demands
+void* test_scheduler_create(int prefill_chunk);
+void test_scheduler_destroy(void* scheduler);
+void test_scheduler_set_weight(void* scheduler, int session, float weight);
+void test_scheduler_plan(void* scheduler, const int* sessions, const int* n_tokens, const bool* decode,
+                         const int* expected, const bool* background, int n_demands, int n_batch, int* grants);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SnapTests_Bridging_Header_h */
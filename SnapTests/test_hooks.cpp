@@ -0,0 +1,86 @@
+#include "SnapTests-Bridging-Header.h"
+#include "fair_scheduler.h"
+#include "gguf_delta.h"
+#include "model_archive.h"
+#include "session_store.h"
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+
+bool test_archive_is_archive(const char* path) {
+    return ModelArchive::isArchive(path);
+}
+
+bool test_archive_pack(const char* src_path, const char* dst_path, uint32_t block_size) {
+    return ModelArchive::pack(src_path, dst_path, block_size);
+}
+
+bool test_archive_unpack(const char* src_path, const char* dst_path, int n_threads) {
+    return ModelArchive::unpack(src_path, dst_path, n_threads);
+}
+
+bool test_delta_create(const char* base_path, const char* target_path, const char* delta_path) {
+    return GgufDelta::create(base_path, target_path, delta_path);
+}
+
+bool test_delta_apply(const char* base_path, const char* delta_path, const char* out_path) {
+    return GgufDelta::apply(base_path, delta_path, out_path);
+}
+
+void* test_session_store_create(size_t ram_budget, const char* spill_dir) {
+    SessionStore* store = new SessionStore();
+    store->setRamBudget(ram_budget);
+    if (spill_dir) {
+        store->setSpillDir(spill_dir);
+    }
+    return store;
+}
+
+void test_session_store_destroy(void* store) {
+    delete static_cast<SessionStore*>(store);
+}
+
+bool test_session_store_save(void* store, int session_id, const uint8_t* state, size_t size) {
+    return static_cast<SessionStore*>(store)->save(session_id, std::vector<uint8_t>(state, state + size));
+}
+
+bool test_session_store_load(void* store, int session_id, uint8_t* state, size_t capacity, size_t* size) {
+    std::vector<uint8_t> loaded;
+    if (!static_cast<SessionStore*>(store)->load(session_id, loaded)) {
+        return false;
+    }
+    memcpy(state, loaded.data(), std::min(capacity, loaded.size()));
+    *size = loaded.size();
+    return true;
+}
+
+size_t test_session_store_ram_bytes(void* store) {
+    return static_cast<SessionStore*>(store)->ramBytes();
+}
+
+void* test_scheduler_create(int prefill_chunk) {
+    FairScheduler* scheduler = new FairScheduler();
+    scheduler->setPrefillChunk(prefill_chunk);
+    return scheduler;
+}
+
+void test_scheduler_destroy(void* scheduler) {
+    delete static_cast<FairScheduler*>(scheduler);
+}
+
+void test_scheduler_set_weight(void* scheduler, int session, float weight) {
+    static_cast<FairScheduler*>(scheduler)->setWeight(session, weight);
+}
+
+void test_scheduler_plan(void* scheduler, const int* sessions, const int* n_tokens, const bool* decode,
+                         const int* expected, const bool* background, int n_demands, int n_batch, int* grants) {
+    std::vector<FairScheduler::Demand> demands(n_demands);
+    for (int i = 0; i < n_demands; i++) {
+        demands[i] = {sessions[i], n_tokens[i], decode[i], expected[i], background[i]};
+    }
+    std::vector<int> planned = static_cast<FairScheduler*>(scheduler)->plan(demands, n_batch);
+    std::copy(planned.begin(), planned.end(), grants);
+}
+
+}  // extern "C"